@@ -0,0 +1,121 @@
+// Enqueue to dispatch latency with the event thread parked on its
+// condition variable, spinning for a while before parking, and always
+// spinning
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/busy_poll.cpp -o busy_poll
+//     ./busy_poll [event thread cpu] [producer cpu] [round trips]
+//
+// The producer posts one event at a time and waits for it to be
+// dispatched, so every event finds the event thread idle. Busy polling
+// only pays off when the event thread has a core to itself; on a machine
+// with fewer cores than spinning threads it is much slower than parking
+
+#include "include/fsm.hpp"
+#include "include/fsm_thread.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+namespace events {
+
+struct ping
+{
+    std::chrono::steady_clock::time_point sent;
+};
+
+using type = std::variant<ping>;
+
+}   // namespace events
+
+namespace states {
+
+struct listening
+{
+};
+
+using type = std::variant<listening>;
+
+}   // namespace states
+
+class ping_state_machine
+  : public fsm::state_machine<ping_state_machine, states::type, events::type>
+{
+  public:
+    fsm::stay react(states::listening &, events::ping &&event)
+    {
+        latency_ = std::chrono::steady_clock::now() - event.sent;
+        dispatched_.store(dispatched_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return {};
+    }
+
+    std::uint64_t dispatched() const noexcept
+    {
+        return dispatched_.load(std::memory_order_acquire);
+    }
+
+    std::chrono::nanoseconds latency() const noexcept
+    {
+        return latency_;
+    }
+
+  private:
+    std::atomic<std::uint64_t> dispatched_{0};
+    std::chrono::nanoseconds   latency_{};
+};
+
+void run(char const *name, std::chrono::nanoseconds spin_limit, unsigned event_cpu, unsigned count)
+{
+    ping_state_machine machine;
+    machine.set_busy_poll(spin_limit);
+    bool const pinned = fsm::pin_event_thread(machine, event_cpu);
+    fsm::name_event_thread(machine, "fsm-busy-poll");
+
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(count);
+    for (unsigned i=0; i<count; ++i) {
+        machine.set_event(events::ping{std::chrono::steady_clock::now()});
+        for (unsigned spins=0; machine.dispatched() == i; ++spins) {
+            if (spins < 1024)
+                fsm::detail::cpu_relax();
+            else
+                std::this_thread::yield();
+        }
+        latencies.push_back(machine.latency().count());
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) {
+        return static_cast<long long>(latencies[std::min(latencies.size() - 1, std::size_t(p * latencies.size()))]);
+    };
+    std::printf("%-18s %10lld %10lld %10lld %10lld%s\n",
+                name, percentile(0.5), percentile(0.99), percentile(0.999), static_cast<long long>(latencies.back()),
+                pinned? "" : "   (not pinned)");
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    using namespace std::literals::chrono_literals;
+
+    unsigned const cpus         = std::max(1u, std::thread::hardware_concurrency());
+    unsigned const event_cpu    = argc > 1? std::atoi(argv[1]) : cpus - 1;
+    unsigned const producer_cpu = argc > 2? std::atoi(argv[2]) : 0;
+    unsigned const count        = argc > 3? std::atoi(argv[3]) : 100'000;
+
+#if defined(_WIN32)
+    fsm::set_thread_affinity(::GetCurrentThread(), producer_cpu);
+#else
+    fsm::set_thread_affinity(::pthread_self(), producer_cpu);
+#endif
+
+    std::printf("event thread on cpu %u, producer on cpu %u, %u round trips\n", event_cpu, producer_cpu, count);
+    std::printf("%-18s %10s %10s %10s %10s\n", "mode", "p50 (ns)", "p99 (ns)", "p99.9 (ns)", "max (ns)");
+    run("parked",            0ns,                            event_cpu, count);
+    run("spin 50us, park",   50us,                           event_cpu, count);
+    run("busy poll",         std::chrono::nanoseconds::max(), event_cpu, count);
+}
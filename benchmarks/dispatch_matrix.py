@@ -0,0 +1,89 @@
+#!/usr/bin/env python3
+"""Compile-time and object size benchmark for fsm::state_machine dispatch.
+
+Generates machines with N states and N events, where each state handles
+two events and one event has a generic handler for every state, then
+compiles each one with and without reduced_dispatch and reports the
+compile time and object file size.
+
+    python benchmarks/dispatch_matrix.py --cxx g++ --sizes 50 100 150 200
+
+The compiler is driven with GCC/Clang style flags.
+"""
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+REPO_ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+
+
+def generate(states, reduced):
+    lines = ['#include "include/fsm.hpp"', '', 'namespace events {']
+    lines += ['struct e%d { int value; };' % i for i in range(states)]
+    lines += ['struct reset { };']
+    lines += ['using type = std::variant<%s, reset>;' % ', '.join('e%d' % i for i in range(states)), '}', '']
+
+    lines += ['namespace states {']
+    lines += ['struct s%d { int count = 0; };' % i for i in range(states)]
+    lines += ['using type = std::variant<%s>;' % ', '.join('s%d' % i for i in range(states)), '}', '']
+
+    lines += ['class machine : public fsm::state_machine<machine, states::type, events::type>',
+              '{',
+              '  public:',
+              '    static constexpr bool reduced_dispatch = %s;' % ('true' if reduced else 'false'),
+              '    using fsm::state_machine<machine, states::type, events::type>::on_event;',
+              '']
+    for i in range(states):
+        lines += ['    auto react(states::s%d &, events::e%d &&) { return fsm::transition_to<states::s%d>(); }'
+                  % (i, i, (i + 1) % states),
+                  '    fsm::stay react(states::s%d &state, events::e%d &&event) { state.count += event.value; return {}; }'
+                  % (i, (i + 1) % states)]
+    lines += ['',
+              '    states::type on_event(auto &&, events::reset &&) { return states::s0(); }',
+              '};',
+              '',
+              'int main()',
+              '{',
+              '    machine fsm;',
+              '    fsm.set_event(events::e0{1});',
+              '    fsm.set_event(events::reset());',
+              '    fsm.wait_for_empty_event_queue();',
+              '}',
+              '']
+    return '\n'.join(lines)
+
+
+def measure(cxx, flags, source, workdir):
+    src = os.path.join(workdir, 'machine.cpp')
+    obj = os.path.join(workdir, 'machine.o')
+    with open(src, 'w') as f:
+        f.write(source)
+    start = time.perf_counter()
+    subprocess.run([cxx, '-std=c++20', '-I', REPO_ROOT, *flags, '-c', src, '-o', obj], check=True)
+    elapsed = time.perf_counter() - start
+    return elapsed, os.path.getsize(obj)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--cxx', default=os.environ.get('CXX', 'c++'))
+    parser.add_argument('--flags', default='-O2 -DNDEBUG', help='extra compiler flags')
+    parser.add_argument('--sizes', type=int, nargs='+', default=[50, 100, 150, 200])
+    args = parser.parse_args()
+
+    print('%6s  %10s  %10s  %12s  %12s' % ('states', 'visit (s)', 'table (s)', 'visit (KB)', 'table (KB)'))
+    with tempfile.TemporaryDirectory() as workdir:
+        for states in args.sizes:
+            visit_time, visit_size = measure(args.cxx, args.flags.split(), generate(states, False), workdir)
+            table_time, table_size = measure(args.cxx, args.flags.split(), generate(states, True), workdir)
+            print('%6d  %10.2f  %10.2f  %12.1f  %12.1f'
+                  % (states, visit_time, table_time, visit_size / 1024, table_size / 1024))
+            sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
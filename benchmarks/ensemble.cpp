@@ -0,0 +1,234 @@
+// Lockstep simulation of a large number of identical crossings, against the
+// same events delivered to real machines, each with its own event thread.
+// A smaller ensemble must first reach the expected census, and every
+// instance the same state, and number of presses while flashing amber, as
+// a real machine given its events. Exits with 1 on a difference
+//
+//     g++ -std=c++20 -O2 -march=native -pthread -I. benchmarks/ensemble.cpp -o ensemble
+//     ./ensemble [instances] [rounds] [threaded machines]
+
+#include "include/fsm.hpp"
+#include "include/fsm_ensemble.hpp"
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <random>
+
+namespace {
+
+namespace events {
+
+struct press_button
+{
+};
+
+struct timeout
+{
+};
+
+struct fault
+{
+};
+
+using type = std::variant<press_button, timeout, fault>;
+
+}   // namespace events
+
+namespace states {
+
+struct red
+{
+};
+
+struct green
+{
+};
+
+struct green_button_pressed
+{
+};
+
+struct amber
+{
+};
+
+// the only state with data, so fault and press_button in it take the
+// per-instance path
+struct amber_flash
+{
+    std::uint32_t presses = 0;
+};
+
+using type = std::variant<red, green, green_button_pressed, amber, amber_flash>;
+
+}   // namespace states
+
+class crossing_state_machine
+  : public fsm::state_machine<crossing_state_machine, states::type, events::type>
+{
+  public:
+    // check() compares real machines through state_snapshot()
+    static constexpr bool snapshot_state = true;
+
+    auto react(states::red &, events::timeout &&)                  { return fsm::transition_to<states::green>(); }
+    auto react(states::green &, events::press_button &&)           { return fsm::transition_to<states::green_button_pressed>(); }
+    auto react(states::green_button_pressed &, events::timeout &&) { return fsm::transition_to<states::amber>(); }
+    auto react(states::amber &, events::timeout &&)                { return fsm::transition_to<states::red>(); }
+
+    template<typename State>
+    auto react(State &, events::fault &&)
+    {
+        return fsm::transition_to<states::amber_flash>();
+    }
+
+    fsm::stay react(states::amber_flash &state, events::press_button &&)
+    {
+        ++state.presses;
+        return {};
+    }
+
+    auto react(states::amber_flash &state, events::timeout &&)
+    {
+        if (state.presses < 3)
+            return states::type(states::amber_flash{state.presses});
+        return states::type(states::red());
+    }
+};
+
+// one round: a fault on roughly one instance in a thousand, a button press
+// on about half of them, then a timeout for everyone
+std::vector<events::type> make_round(std::size_t instances, std::mt19937 &random)
+{
+    std::vector<events::type> events(instances);
+    for (auto &event : events) {
+        auto const r = random() % 2000;
+        if (r < 2)
+            event = events::fault();
+        else if (r < 1000)
+            event = events::press_button();
+        else
+            event = events::timeout();
+    }
+    return events;
+}
+
+// a fixed ensemble against real machines driven from this thread, and
+// against the census it is known to reach
+bool check()
+{
+    std::size_t const instances = 10'000;
+    unsigned const    rounds    = 20;
+
+    // a different round each time, so instances flashing amber are pressed
+    // and leave it again
+    std::mt19937 random(7);
+    std::vector<std::vector<events::type>> played;
+    for (unsigned i=0; i<rounds; ++i)
+        played.push_back(make_round(instances, random));
+
+    fsm::ensemble<crossing_state_machine> crossings(instances);
+    for (auto const &round : played) {
+        crossings.apply(std::span(round));
+        crossings.apply(events::timeout());
+    }
+
+    std::array<std::size_t, 5> const expected_census = { 1391, 5607, 0, 2951, 51 };
+    if (crossings.census() != expected_census) {
+        std::printf("ensemble census");
+        for (auto count : crossings.census())
+            std::printf(" %zu", count);
+        std::printf(" is not the one expected\n");
+        return false;
+    }
+
+    std::size_t pressed = 0;
+    for (std::size_t m=0; m<instances; ++m) {
+        crossing_state_machine machine;
+        machine.use_external_loop();
+        for (auto const &round : played) {
+            machine.set_event(events::type(round[m]));
+            machine.set_event(events::timeout());
+            machine.poll_once();
+        }
+
+        auto const state    = machine.state_snapshot();
+        auto const expected = crossings.state(m);
+        auto const flashing = std::get_if<states::amber_flash>(&state);
+        if (state.index() != expected.index()
+        ||  (flashing  &&  flashing->presses != std::get<states::amber_flash>(expected).presses))
+        {
+            std::printf("instance %zu is in state %zu, but a real machine is in state %zu\n", m, expected.index(), state.index());
+            return false;
+        }
+        pressed += flashing  &&  flashing->presses != 0;
+    }
+
+    // the presses are only compared if some instance is flashing amber with them
+    if (pressed == 0) {
+        std::printf("no instance is flashing amber with presses\n");
+        return false;
+    }
+    std::printf("%zu instances match real machines and the expected census\n", instances);
+    return true;
+}
+
+double run_ensemble(std::size_t instances, unsigned rounds, std::vector<events::type> const &round)
+{
+    fsm::ensemble<crossing_state_machine> crossings(instances);
+
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<rounds; ++i) {
+        crossings.apply(std::span(round));
+        crossings.apply(events::timeout());
+    }
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    auto const census = crossings.census();
+    std::printf("ensemble census     ");
+    for (auto count : census)
+        std::printf(" %zu", count);
+    std::printf("\n");
+    return elapsed;
+}
+
+double run_threaded(std::size_t machines, unsigned rounds, std::vector<events::type> const &round)
+{
+    std::vector<std::unique_ptr<crossing_state_machine>> crossings;
+    for (std::size_t i=0; i<machines; ++i)
+        crossings.push_back(std::make_unique<crossing_state_machine>());
+
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<rounds; ++i) {
+        for (std::size_t m=0; m<machines; ++m) {
+            crossings[m]->set_event(events::type(round[m]));
+            crossings[m]->set_event(events::timeout());
+        }
+    }
+    for (auto &crossing : crossings)
+        crossing->wait_for_empty_event_queue();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    std::size_t const instances = argc > 1? std::atoi(argv[1]) : 1'000'000;
+    unsigned const    rounds    = argc > 2? std::atoi(argv[2]) : 100;
+    std::size_t const machines  = argc > 3? std::atoi(argv[3]) : 100;
+
+    if (!check())
+        return 1;
+
+    std::mt19937 random(42);
+    auto const round = make_round(instances, random);
+
+    auto const ensemble = run_ensemble(instances, rounds, round);
+    auto const threaded = run_threaded(machines, rounds, round);
+
+    std::printf("%zu instances, %u rounds of 2 events\n", instances, rounds);
+    std::printf("ensemble             %10.2f M instance-transitions/s\n", 2.0 * instances * rounds / ensemble / 1e6);
+    std::printf("thread per machine   %10.2f M instance-transitions/s (%zu machines)\n", 2.0 * machines * rounds / threaded / 1e6, machines);
+}
@@ -0,0 +1,124 @@
+// Many machines multiplexed into one epoll loop through their eventfds,
+// against the same machines each running their own event thread. Linux only
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/epoll_loop.cpp -o epoll_loop
+//     ./epoll_loop [machines] [events]
+
+#include "include/fsm.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#include <sys/epoll.h>
+
+namespace {
+
+namespace events {
+
+struct toggle
+{
+};
+
+using type = std::variant<toggle>;
+
+}   // namespace events
+
+namespace states {
+
+struct off
+{
+};
+
+struct on
+{
+};
+
+using type = std::variant<off, on>;
+
+}   // namespace states
+
+std::atomic<std::uint64_t> dispatched{0};
+
+class switch_state_machine
+  : public fsm::state_machine<switch_state_machine, states::type, events::type>
+{
+  public:
+    auto react(states::off &, events::toggle &&)
+    {
+        dispatched.fetch_add(1, std::memory_order_relaxed);
+        return fsm::transition_to<states::on>();
+    }
+
+    auto react(states::on &, events::toggle &&)
+    {
+        dispatched.fetch_add(1, std::memory_order_relaxed);
+        return fsm::transition_to<states::off>();
+    }
+};
+
+void produce(std::vector<std::unique_ptr<switch_state_machine>> &machines, unsigned events)
+{
+    for (unsigned i=0; i<events; ++i)
+        machines[i % machines.size()]->set_event(events::toggle());
+}
+
+double run_threaded(unsigned count, unsigned events)
+{
+    std::vector<std::unique_ptr<switch_state_machine>> machines;
+    for (unsigned i=0; i<count; ++i)
+        machines.push_back(std::make_unique<switch_state_machine>());
+
+    dispatched = 0;
+    auto const start = std::chrono::steady_clock::now();
+    produce(machines, events);
+    for (auto &machine : machines)
+        machine->wait_for_empty_event_queue();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double run_epoll(unsigned count, unsigned events)
+{
+    int const epoll = ::epoll_create1(EPOLL_CLOEXEC);
+    std::vector<std::unique_ptr<switch_state_machine>> machines;
+    for (unsigned i=0; i<count; ++i) {
+        auto &machine = machines.emplace_back(std::make_unique<switch_state_machine>());
+        machine->use_external_loop();
+
+        epoll_event event{};
+        event.events   = EPOLLIN;
+        event.data.ptr = machine.get();
+        ::epoll_ctl(epoll, EPOLL_CTL_ADD, machine->event_fd(), &event);
+    }
+
+    dispatched = 0;
+    auto const start = std::chrono::steady_clock::now();
+    std::thread producer([&] { produce(machines, events); });
+
+    epoll_event ready[64];
+    while (dispatched.load(std::memory_order_relaxed) < events) {
+        // a machine with timers would also bound the wait by the earliest
+        // next_timer_deadline()
+        int const n = ::epoll_wait(epoll, ready, 64, 100);
+        for (int i=0; i<n; ++i)
+            static_cast<switch_state_machine *>(ready[i].data.ptr)->poll_once(64);
+    }
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    producer.join();
+    ::close(epoll);
+    return elapsed;
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned const machines = argc > 1? std::atoi(argv[1]) : 64;
+    unsigned const events   = argc > 2? std::atoi(argv[2]) : 1'000'000;
+
+    std::printf("%u machines, %u events\n", machines, events);
+    std::printf("thread per machine   %8.2f Mevents/s\n", events / run_threaded(machines, events) / 1e6);
+    std::printf("one epoll loop       %8.2f Mevents/s\n", events / run_epoll(machines, events) / 1e6);
+}
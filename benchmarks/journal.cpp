@@ -0,0 +1,183 @@
+// Cost of journalling events with group commit, against one fdatasync()
+// per event, followed by recovery of a fresh machine from the journal.
+// Every event must be journalled as it is queued, and the recovered
+// machine must reach the same state. A snapshot that can't be written
+// must be reported without stopping commits. Exits with 1 on a failure.
+// POSIX only
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/journal.cpp -o journal
+//     ./journal [events] [journal path]
+
+#include "include/fsm.hpp"
+#include "include/fsm_journal.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+namespace {
+
+namespace events {
+
+struct toggle
+{
+    std::uint32_t sequence;
+};
+
+struct reset
+{
+};
+
+using type = std::variant<toggle, reset>;
+
+}   // namespace events
+
+namespace states {
+
+struct off
+{
+    std::uint32_t last;
+};
+
+struct on
+{
+    std::uint32_t last;
+};
+
+using type = std::variant<off, on>;
+
+}   // namespace states
+
+class switch_state_machine
+  : public fsm::state_machine<switch_state_machine, states::type, events::type>
+{
+  public:
+    auto react(states::off &, events::toggle &&event)
+    {
+        return fsm::transition_to<states::on>(event.sequence);
+    }
+
+    auto react(states::on &, events::toggle &&event)
+    {
+        return fsm::transition_to<states::off>(event.sequence);
+    }
+
+    auto react(auto &, events::reset &&)
+    {
+        return fsm::transition_to<states::off>(0u);
+    }
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+double fdatasync_cost(std::string const &path, unsigned count)
+{
+    int const fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        std::perror("open");
+        std::exit(1);
+    }
+
+    char record[8] = {};
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<count; ++i) {
+        if (::write(fd, record, sizeof(record)) != sizeof(record)  ||  ::fdatasync(fd) == -1) {
+            std::perror("fdatasync");
+            std::exit(1);
+        }
+    }
+    auto const elapsed = seconds_since(start);
+    ::close(fd);
+    ::unlink(path.c_str());
+    return elapsed / count;
+}
+
+// a directory in the way of the snapshot makes every snapshot fail, and
+// events must still be journalled
+bool check_snapshot_failure(std::string const &path)
+{
+    auto const snapshot = fsm::event_journal<events::type>::snapshot_path(path);
+    ::unlink(path.c_str());
+    if (::mkdir(snapshot.c_str(), 0755) == -1) {
+        std::perror("mkdir");
+        return false;
+    }
+
+    bool journalled = true;
+    std::error_code error;
+    {
+        fsm::event_journal<events::type> journal(path);
+        switch_state_machine machine;
+        journal.attach(machine, 10);
+        try {
+            for (std::uint32_t i=0; i<100; ++i) {
+                journal.post(machine, events::toggle{i});
+                machine.wait_for_empty_event_queue();
+            }
+            journal.flush();
+        }
+        catch (std::system_error const &) {
+            journalled = false;
+        }
+        journalled = journalled  &&  journal.records() == 100;
+        error = journal.snapshot_error();
+    }
+    ::rmdir(snapshot.c_str());
+    ::unlink(path.c_str());
+
+    std::printf("failed snapshot         %s, %s\n", error? "reported" : "NOT REPORTED", journalled? "events journalled" : "EVENTS LOST");
+    return error  &&  journalled;
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    std::uint32_t const count = argc > 1? std::atoi(argv[1]) : 1'000'000;
+    std::string const   path  = argc > 2? argv[2] : "fsm_bench.journal";
+
+    ::unlink(path.c_str());
+    ::unlink(fsm::event_journal<events::type>::snapshot_path(path).c_str());
+
+    std::printf("fdatasync per event     %10.2f us\n", fdatasync_cost(path + ".sync", 200) * 1e6);
+    if (!check_snapshot_failure(path + ".failing"))
+        return 1;
+
+    std::size_t recorded_state;
+    bool        journalled_on_accept;
+    {
+        fsm::event_journal<events::type> journal(path);
+        switch_state_machine machine;
+        journal.attach(machine, count / 4);
+
+        auto const start = std::chrono::steady_clock::now();
+        for (std::uint32_t i=0; i<count; ++i)
+            machine.set_event(events::toggle{i});
+        machine.set_event(events::reset{});
+        journalled_on_accept = journal.records() == count + 1;
+        journal.post(machine, events::toggle{count});
+        machine.wait_for_empty_event_queue();
+        auto const elapsed = seconds_since(start);
+
+        recorded_state = machine.current_state_index();
+        std::printf("group commit per event  %10.2f us   (%llu events, %llu commits)\n",
+                    elapsed / journal.records() * 1e6,
+                    static_cast<unsigned long long>(journal.records()),
+                    static_cast<unsigned long long>(journal.commits()));
+        if (!journalled_on_accept)
+            std::printf("events were not journalled as they were queued\n");
+    }
+
+    switch_state_machine recovered;
+    auto const result = fsm::recover(recovered, path);
+    recovered.wait_for_empty_event_queue();
+    std::printf("recovery                %10.2f Mevents/s (%llu events after snapshot, %s, state %s)\n",
+                result.events_per_second() / 1e6,
+                static_cast<unsigned long long>(result.events),
+                result.ok()? "ok" : "FAILED",
+                recovered.current_state_index() == recorded_state? "matches" : "DIFFERS");
+    return result.ok()  &&  journalled_on_accept  &&  recovered.current_state_index() == recorded_state? 0 : 1;
+}
@@ -0,0 +1,94 @@
+// line_index against counting lines and columns a character at a time:
+// every offset of texts with lines of random lengths, with and without a
+// newline at the end, must give the same location. Exits with 1 on the
+// first difference, then reports the throughput of building the index
+// and the rate of lookups
+//
+//     g++ -std=c++20 -O2 -march=native -I. benchmarks/line_index.cpp -o line_index
+//     ./line_index [megabytes]
+
+#include "samples/line_index.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+namespace {
+
+// lines of up to max_line characters, some of them empty
+std::string random_lines(std::size_t size, std::size_t max_line, std::mt19937 &random)
+{
+    std::string text;
+    while (text.size() < size) {
+        text.append(std::uniform_int_distribution<std::size_t>(0, max_line)(random), 'x');
+        text += '\n';
+    }
+    return text;
+}
+
+bool compare(char const *name, std::string const &text)
+{
+    tokeniser::line_index const index(text);
+    std::size_t line   = 1;
+    std::size_t column = 1;
+    for (std::size_t offset=0; offset<=text.size(); ++offset) {
+        auto const location = index.locate(offset);
+        if (location.line != line  ||  location.column != column) {
+            std::printf("%s: offset %zu is at %zu:%zu, not %zu:%zu\n", name, offset, location.line, location.column, line, column);
+            return false;
+        }
+
+        if (offset < text.size()  &&  text[offset] == '\n') {
+            ++line;
+            column = 1;
+        }
+        else
+            ++column;
+    }
+    if (index.lines() != line) {
+        std::printf("%s: %zu lines, not %zu\n", name, index.lines(), line);
+        return false;
+    }
+    std::printf("%-30s %zu lines located identically\n", name, line);
+    return true;
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    auto const megabytes = argc > 1? std::strtoul(argv[1], nullptr, 10) : 64;
+
+    std::mt19937 random(1);
+    auto const short_lines = random_lines(1 << 16, 40, random);
+    auto const long_lines  = random_lines(1 << 16, 200, random);
+    if (!compare("empty", "")
+    ||  !compare("newline", "\n")
+    ||  !compare("no newline", "int main()")
+    ||  !compare("short lines", short_lines)
+    ||  !compare("long lines", long_lines)
+    ||  !compare("no newline at the end", short_lines + "return value"))
+    {
+        return 1;
+    }
+
+    auto const text = random_lines(megabytes << 20, 80, random);
+    auto const start = std::chrono::steady_clock::now();
+    tokeniser::line_index const index(text);
+    auto const lines = index.lines();
+    std::chrono::duration<double> const indexing = std::chrono::steady_clock::now() - start;
+    std::printf("indexed %zu lines      %8.2f MB/s\n", lines, text.size() / indexing.count() / 1e6);
+
+    std::size_t const lookups = 1 << 22;
+    std::uint64_t     sum     = 0;
+    std::uniform_int_distribution<std::size_t> offsets(0, text.size());
+    auto const lookup_start = std::chrono::steady_clock::now();
+    for (std::size_t i=0; i<lookups; ++i) {
+        auto const location = index.locate(offsets(random));
+        sum += location.line + location.column;
+    }
+    std::chrono::duration<double> const looking_up = std::chrono::steady_clock::now() - lookup_start;
+    std::printf("random lookups         %8.2f million/s (%llu)\n", lookups / looking_up.count() / 1e6, static_cast<unsigned long long>(sum));
+}
@@ -0,0 +1,110 @@
+// Resident memory for a large number of mostly idle machines, with idle
+// machines passivated into a state store. Linux only, as resident memory
+// is read from /proc
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/passivation.cpp -o passivation
+//     ./passivation [machines] [active at once]
+
+#include "include/fsm.hpp"
+#include "include/fsm_passivation.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+
+#include <unistd.h>
+
+namespace {
+
+namespace events {
+
+struct press_button
+{
+};
+
+using type = std::variant<press_button>;
+
+}   // namespace events
+
+namespace states {
+
+struct waiting
+{
+    std::uint32_t presses;
+};
+
+struct walking
+{
+    std::uint32_t presses;
+};
+
+using type = std::variant<waiting, walking>;
+
+}   // namespace states
+
+class crossing_state_machine
+  : public fsm::state_machine<crossing_state_machine, states::type, events::type>
+{
+  public:
+    auto react(states::waiting &state, events::press_button &&)
+    {
+        return fsm::transition_to<states::walking>(state.presses + 1);
+    }
+
+    auto react(states::walking &state, events::press_button &&)
+    {
+        return fsm::transition_to<states::waiting>(state.presses + 1);
+    }
+};
+
+std::size_t resident_bytes()
+{
+    std::size_t pages = 0, resident = 0;
+    std::ifstream("/proc/self/statm") >> pages >> resident;
+    return resident * ::sysconf(_SC_PAGESIZE);
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned const machines = argc > 1? std::atoi(argv[1]) : 100'000;
+    unsigned const batch    = argc > 2? std::atoi(argv[2]) : 1'000;
+
+    using namespace std::literals::chrono_literals;
+    fsm::passivating_registry<crossing_state_machine, unsigned> crossings(0s);
+
+    auto const baseline = resident_bytes();
+    auto const start    = std::chrono::steady_clock::now();
+
+    // press every crossing's button twice, keeping at most a batch of
+    // machines active
+    for (unsigned round=0; round<2; ++round) {
+        for (unsigned key=0; key<machines; ++key) {
+            crossings.post(key, events::press_button());
+            if (key % batch == batch - 1) {
+                while (crossings.active() != 0)
+                    crossings.passivate_idle();
+            }
+        }
+    }
+    while (crossings.active() != 0)
+        crossings.passivate_idle();
+
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+    auto const resident = resident_bytes() - baseline;
+
+    unsigned correct = 0;
+    for (unsigned key=0; key<machines; ++key) {
+        auto const state = crossings.state(key);
+        if (state  &&  std::holds_alternative<states::waiting>(*state)  &&  std::get<states::waiting>(*state).presses == 2)
+            ++correct;
+    }
+
+    std::printf("%u machines, %u active at once\n", machines, batch);
+    std::printf("machine object size                 %8zu bytes, before its thread\n", sizeof(crossing_state_machine));
+    std::printf("resident per passivated machine     %8.1f bytes\n", double(resident) / machines);
+    std::printf("rehydrate, dispatch, passivate      %8.2f us per event\n", elapsed.count() * 1e6 / (2.0 * machines));
+    std::printf("machines in the expected state      %8u\n", correct);
+    return correct == machines? 0 : 1;
+}
@@ -0,0 +1,119 @@
+// Per-use cost of a short-lived state machine: constructing one for each
+// use, which starts and joins its event thread, against reusing reset
+// machines from a pool. A machine must come back from the pool in its
+// initial state, with its own members reset; exits with 1 if not
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/pool.cpp -o pool
+//     ./pool [uses]
+
+#include "include/fsm.hpp"
+#include "include/fsm_pool.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+
+namespace {
+
+namespace events {
+
+struct toggle
+{
+};
+
+using type = std::variant<toggle>;
+
+}   // namespace events
+
+namespace states {
+
+struct off
+{
+};
+
+struct on
+{
+};
+
+using type = std::variant<off, on>;
+
+}   // namespace states
+
+class switch_state_machine
+  : public fsm::state_machine<switch_state_machine, states::type, events::type>
+{
+  public:
+    auto react(states::off &, events::toggle &&)
+    {
+        return fsm::transition_to<states::on>();
+    }
+
+    auto react(states::on &, events::toggle &&)
+    {
+        return fsm::transition_to<states::off>();
+    }
+
+    void use()
+    {
+        ++uses;
+        set_event(events::toggle{});
+        wait_for_empty_event_queue();
+    }
+
+    void on_reset()
+    {
+        uses = 0;
+    }
+
+    unsigned uses = 0;
+};
+
+template<typename Fn>
+void measure(char const *name, unsigned uses, Fn fn)
+{
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<uses; ++i)
+        fn();
+    std::chrono::duration<double, std::nano> const elapsed = std::chrono::steady_clock::now() - start;
+    std::printf("%-30s %12.0f ns per use\n", name, elapsed.count() / uses);
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned const uses = argc > 1? std::atoi(argv[1]) : 20'000;
+
+    measure("construct, destroy", uses, [] {
+        switch_state_machine machine;
+    });
+
+    measure("construct, one event, destroy", uses, [] {
+        switch_state_machine machine;
+        machine.use();
+    });
+
+    fsm::state_machine_pool<switch_state_machine> pool(1);
+    measure("acquire, release", uses, [&pool] {
+        auto machine = pool.acquire();
+    });
+
+    measure("acquire, one event, release", uses, [&pool] {
+        auto machine = pool.acquire();
+        machine->use();
+    });
+
+    switch_state_machine machine;
+    measure("one event on a long-lived machine", uses, [&machine] {
+        machine.use();
+    });
+
+    {
+        auto used = pool.acquire();
+        used->use();
+    }
+    auto const reused = pool.acquire();
+    if (!reused->is_in<states::off>()  ||  reused->uses != 0) {
+        std::printf("a pooled machine was not reset\n");
+        return 1;
+    }
+}
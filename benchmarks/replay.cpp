@@ -0,0 +1,165 @@
+// Round trip through the event recorder: a machine that defers events and
+// posts its own is recorded while it runs, and the recording is replayed
+// into a fresh machine, which must reach the same state and counts with
+// every event delivered to the state it was recorded in. A recording
+// replayed into a machine started in another state must report the
+// divergence, and a crossing on a virtual clock must see its events at
+// the simulated times they were recorded at. Exits with 1 on a failure,
+// then reports the replay rate
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/replay.cpp -o replay
+//     ./replay [jobs]
+
+#include "include/fsm.hpp"
+#include "include/fsm_recorder.hpp"
+#include "samples/pedestrian_crossing.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <sstream>
+
+namespace {
+
+namespace events {
+
+struct job
+{
+    std::uint32_t id;
+};
+
+struct finish
+{
+};
+
+using type = std::variant<job, finish>;
+
+}   // namespace events
+
+namespace states {
+
+struct idle
+{
+};
+
+// holds jobs back until the one in hand is finished
+struct working
+{
+    using deferred_events = fsm::defer<events::job>;
+
+    std::uint32_t id;
+};
+
+using type = std::variant<idle, working>;
+
+}   // namespace states
+
+class worker_state_machine
+  : public fsm::state_machine<worker_state_machine, states::type, events::type>
+{
+  public:
+    auto react(states::idle &, events::job &&event)
+    {
+        set_event(events::finish());
+        return fsm::transition_to<states::working>(event.id);
+    }
+
+    auto react(states::working &state, events::finish &&)
+    {
+        ++finished;
+        checksum = checksum * 31 + state.id;
+        return fsm::transition_to<states::idle>();
+    }
+
+    std::uint64_t finished = 0;
+    std::uint64_t checksum = 0;
+};
+
+// records a crossing on simulated time, and replays it into another,
+// checking both see each event at the time expected
+bool check_timed_replay()
+{
+    using namespace std::literals::chrono_literals;
+    using crossing_t = pedestrian_crossing::basic_crossing_state_machine<fsm::virtual_clock>;
+    namespace crossing_events = pedestrian_crossing::events;
+
+    // the press at 30s, then the green, amber, red and flashing amber
+    // timers, of 10s, 2s, 15s and 5s
+    std::vector<std::chrono::nanoseconds> const expected = { 0s, 30s, 40s, 42s, 57s, 62s };
+
+    auto observe_times = [](crossing_t &crossing, std::vector<std::chrono::nanoseconds> &times) {
+        crossing.add_dispatch_observer(
+            [&crossing, &times](crossing_events::type const &, std::size_t) {
+                times.push_back(crossing.clock().now().time_since_epoch());
+            });
+    };
+
+    std::ostream                               no_display(nullptr);
+    std::stringstream                          log;
+    fsm::event_recorder<crossing_events::type> recorder(log);
+    crossing_t                                 recorded(no_display);
+    std::vector<std::chrono::nanoseconds>      recorded_times;
+    observe_times(recorded, recorded_times);
+    recorder.attach(recorded);
+    recorded.set_event(crossing_events::initialised());
+    recorded.schedule_event(30s, crossing_events::press_button());
+    recorded.wait_for_idle();
+
+    crossing_t                            replayed(no_display);
+    std::vector<std::chrono::nanoseconds> replayed_times;
+    observe_times(replayed, replayed_times);
+    auto const result = fsm::replay(replayed, log);
+
+    bool const same = result.ok()
+                  &&  recorded_times == expected
+                  &&  replayed_times == expected
+                  &&  replayed.is_in<pedestrian_crossing::states::green>();
+    std::printf("timed replay            %s\n", same? "matches" : "DIFFERS");
+    return same;
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    std::uint32_t const jobs = argc > 1? std::atoi(argv[1]) : 100'000;
+
+    std::stringstream                 log;
+    fsm::event_recorder<events::type> recorder(log);
+    worker_state_machine              recorded;
+    recorder.attach(recorded);
+
+    // in small batches, as every job still deferred is delivered again
+    // each time one is finished
+    for (std::uint32_t i=0; i<jobs; ++i) {
+        recorded.set_event(events::job{i});
+        if (i % 4 == 3)
+            recorded.wait_for_idle();
+    }
+    recorded.wait_for_idle();
+
+    worker_state_machine replayed;
+    auto const result = fsm::replay(replayed, log);
+    bool const same = replayed.current_state_index() == recorded.current_state_index()
+                  &&  replayed.finished == recorded.finished
+                  &&  replayed.checksum == recorded.checksum;
+    std::printf("replay                  %10.2f Mevents/s (%llu events, %llu jobs finished, %s, state %s)\n",
+                result.events_per_second() / 1e6,
+                static_cast<unsigned long long>(result.events),
+                static_cast<unsigned long long>(replayed.finished),
+                result.ok()? "ok" : "FAILED",
+                same? "matches" : "DIFFERS");
+
+    // a machine that starts out working delivers the first job to another
+    // state than the one recorded
+    worker_state_machine diverged;
+    diverged.restore_state(states::working{0});
+    log.clear();
+    log.seekg(0);
+    auto const divergence = fsm::replay(diverged, log);
+    std::printf("divergence              %s at record %llu\n",
+                divergence.mismatches != 0? "reported" : "NOT REPORTED",
+                static_cast<unsigned long long>(divergence.first_mismatch));
+
+    bool const timed = check_timed_replay();
+    return result.ok()  &&  same  &&  recorded.finished == jobs  &&  divergence.mismatches != 0  &&  divergence.first_mismatch == 1  &&  timed? 0 : 1;
+}
@@ -0,0 +1,313 @@
+// Cross-process event throughput and latency, shared memory queue against
+// a Unix domain socket baseline. Linux only
+//
+//     g++ -std=c++20 -O2 -pthread -I. benchmarks/shm_queue.cpp -o shm_queue -lrt
+//     ./shm_queue [producers] [events per producer]
+//
+// Each producer is a forked process that posts timestamped events as fast
+// as it can. Latency is measured from the producer's timestamp to the
+// point the event is taken off the transport, or, for the state machine
+// runs, to the point it is dispatched; CLOCK_MONOTONIC is shared by every
+// process on the host. Producers run flat out, so latency is measured
+// with the transport saturated. Pushing to a full ring, and opening a
+// segment its creator hasn't sized, must first time out. Exits with 1 if
+// they don't
+
+#include "include/fsm.hpp"
+#include "include/fsm_shm_queue.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+namespace events {
+
+struct ping
+{
+    std::int64_t  sent_ns;
+    std::uint32_t producer;
+    std::uint32_t sequence;
+};
+
+using type = std::variant<ping>;
+
+}   // namespace events
+
+namespace states {
+
+struct listening
+{
+};
+
+using type = std::variant<listening>;
+
+}   // namespace states
+
+std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+class ping_state_machine
+  : public fsm::state_machine<ping_state_machine, states::type, events::type>
+{
+  public:
+    explicit ping_state_machine(std::size_t expected)
+    {
+        latencies_.reserve(expected);
+    }
+
+    fsm::stay react(states::listening &, events::ping &&event)
+    {
+        latencies_.push_back(now_ns() - event.sent_ns);
+        return {};
+    }
+
+    std::vector<std::int64_t> &latencies()
+    {
+        return latencies_;
+    }
+
+  private:
+    std::vector<std::int64_t> latencies_;
+};
+
+struct result
+{
+    char const                *name;
+    double                     seconds;
+    std::vector<std::int64_t>  latencies;
+};
+
+void report(result &r)
+{
+    auto &lat = r.latencies;
+    std::sort(lat.begin(), lat.end());
+    auto percentile = [&lat](double p) {
+        return lat.empty()? 0 : lat[std::min(lat.size() - 1, std::size_t(p * lat.size()))];
+    };
+    std::printf("%-12s %12.0f %10lld %10lld %10lld\n",
+                r.name,
+                lat.size() / r.seconds,
+                static_cast<long long>(percentile(0.50)),
+                static_cast<long long>(percentile(0.99)),
+                static_cast<long long>(percentile(0.999)));
+}
+
+// fork the producers before the consumer starts any threads. they block
+// until start_producers() closes the pipe, so every run measures from the
+// same starting line
+template<typename Produce>
+int spawn_producers(unsigned producers, Produce produce)
+{
+    int go[2];
+    if (::pipe(go) == -1) {
+        std::perror("pipe");
+        std::exit(1);
+    }
+
+    for (unsigned p=0; p<producers; ++p) {
+        if (::fork() == 0) {
+            ::close(go[1]);
+            char ch;
+            while (::read(go[0], &ch, 1) != 0)
+                ;
+            produce(p);
+            std::_Exit(0);
+        }
+    }
+    ::close(go[0]);
+    return go[1];
+}
+
+void start_producers(int go)
+{
+    ::close(go);
+}
+
+void reap_producers(unsigned producers)
+{
+    for (unsigned p=0; p<producers; ++p)
+        ::wait(nullptr);
+}
+
+result run_socket(unsigned producers, std::uint32_t count)
+{
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_DGRAM, 0, fds) == -1) {
+        std::perror("socketpair");
+        std::exit(1);
+    }
+
+    int const go = spawn_producers(producers, [&](unsigned p) {
+        ::close(fds[0]);
+        for (std::uint32_t i=0; i<count; ++i) {
+            events::ping ping{now_ns(), p, i};
+            while (::send(fds[1], &ping, sizeof(ping), 0) == -1)
+                ;
+        }
+    });
+    ::close(fds[1]);
+
+    result r{"socket", 0, {}};
+    r.latencies.reserve(std::size_t(producers) * count);
+    auto const start = now_ns();
+    start_producers(go);
+    events::ping ping;
+    while (r.latencies.size() < std::size_t(producers) * count) {
+        if (::recv(fds[0], &ping, sizeof(ping), 0) == sizeof(ping))
+            r.latencies.push_back(now_ns() - ping.sent_ns);
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    ::close(fds[0]);
+    reap_producers(producers);
+    return r;
+}
+
+result run_shm(unsigned producers, std::uint32_t count)
+{
+    std::string const name = "/fsm_bench_" + std::to_string(::getpid());
+    auto queue = fsm::shm_event_queue<events::ping>::create(name, 4096);
+
+    int const go = spawn_producers(producers, [&](unsigned p) {
+        auto producer = fsm::shm_event_queue<events::ping>::open(name);
+        for (std::uint32_t i=0; i<count; ++i)
+            producer.push({now_ns(), p, i});
+    });
+
+    result r{"shm", 0, {}};
+    r.latencies.reserve(std::size_t(producers) * count);
+    auto const start = now_ns();
+    start_producers(go);
+    events::ping ping;
+    while (r.latencies.size() < std::size_t(producers) * count) {
+        if (queue.try_pop(ping))
+            r.latencies.push_back(now_ns() - ping.sent_ns);
+        else
+            std::this_thread::yield();
+    }
+    r.seconds = (now_ns() - start) / 1e9;
+    reap_producers(producers);
+    return r;
+}
+
+result run_shm_fsm(unsigned producers, std::uint32_t count)
+{
+    std::string const name = "/fsm_bench_" + std::to_string(::getpid());
+    auto queue = fsm::shm_event_queue<events::type>::create(name, 4096);
+
+    int const go = spawn_producers(producers, [&](unsigned p) {
+        auto producer = fsm::shm_event_queue<events::type>::open(name);
+        for (std::uint32_t i=0; i<count; ++i)
+            producer.push(events::ping{now_ns(), p, i});
+    });
+
+    std::size_t const expected = std::size_t(producers) * count;
+    ping_state_machine machine(expected);
+    auto const start = now_ns();
+    {
+        fsm::shm_event_pump pump(machine, queue);
+        start_producers(go);
+        while (pump.events() < expected)
+            std::this_thread::yield();
+    }
+    machine.wait_for_empty_event_queue();
+
+    result r{"shm + fsm", (now_ns() - start) / 1e9, std::move(machine.latencies())};
+    reap_producers(producers);
+    return r;
+}
+
+// the machine is driven from this thread, without the pump's thread hop
+result run_shm_loop(unsigned producers, std::uint32_t count)
+{
+    std::string const name = "/fsm_bench_" + std::to_string(::getpid());
+    auto queue = fsm::shm_event_queue<events::type>::create(name, 4096);
+
+    int const go = spawn_producers(producers, [&](unsigned p) {
+        auto producer = fsm::shm_event_queue<events::type>::open(name);
+        for (std::uint32_t i=0; i<count; ++i)
+            producer.push(events::ping{now_ns(), p, i});
+    });
+
+    std::size_t const expected = std::size_t(producers) * count;
+    ping_state_machine machine(expected);
+    machine.use_external_loop();
+    auto const start = now_ns();
+    start_producers(go);
+    while (machine.latencies().size() < expected) {
+        if (queue.poll(machine) == 0)
+            std::this_thread::yield();
+    }
+
+    result r{"shm + loop", (now_ns() - start) / 1e9, std::move(machine.latencies())};
+    reap_producers(producers);
+    return r;
+}
+
+// a full ring with no consumer, and a segment whose creator stopped
+// before sizing it, must time out rather than spin or fail
+bool check_timeouts()
+{
+    using namespace std::literals::chrono_literals;
+    std::string const name = "/fsm_bench_" + std::to_string(::getpid());
+
+    auto timed_out = [](auto &&fn) {
+        try {
+            fn();
+        }
+        catch (std::system_error const &e) {
+            return e.code() == std::errc::timed_out;
+        }
+        return false;
+    };
+
+    bool full_ring;
+    {
+        auto queue = fsm::shm_event_queue<events::ping>::create(name, 2);
+        queue.push({0, 0, 0});
+        queue.push({0, 0, 1});
+        full_ring = timed_out([&queue] { queue.push({0, 0, 2}, 10ms); });
+    }
+
+    int const fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    bool const unsized = fd != -1  &&  timed_out([&name] { fsm::shm_event_queue<events::ping>::open(name, 10ms); });
+    if (fd != -1) {
+        ::close(fd);
+        fsm::shm_event_queue<events::ping>::remove(name);
+    }
+
+    std::printf("full ring %s, unsized segment %s\n", full_ring? "timed out" : "DID NOT TIME OUT", unsized? "timed out" : "DID NOT TIME OUT");
+    return full_ring  &&  unsized;
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned const      producers = argc > 1? std::atoi(argv[1]) : 4;
+    std::uint32_t const count     = argc > 2? std::atoi(argv[2]) : 1'000'000;
+
+    if (!check_timeouts())
+        return 1;
+
+    std::printf("%u producers, %u events each\n", producers, count);
+    std::printf("%-12s %12s %10s %10s %10s\n", "transport", "events/s", "p50 (ns)", "p99 (ns)", "p99.9 (ns)");
+
+    for (auto run : { &run_socket, &run_shm, &run_shm_fsm, &run_shm_loop }) {
+        auto r = run(producers, count);
+        report(r);
+    }
+}
@@ -0,0 +1,230 @@
+// Dispatch latency of a static_state_machine stepped from a loop, with
+// global operator new replaced to count allocations. Exits with 1 if
+// anything was allocated while dispatching, or if the worst case latency
+// exceeds the optional limit
+//
+//     g++ -std=c++20 -O2 -I. benchmarks/static_dispatch.cpp -o static_dispatch
+//     ./static_dispatch [events] [max ns]
+
+#include "include/fsm_static.hpp"
+
+// the freestanding header must not pull in the parts of the library that
+// do I/O or own threads
+#if defined(__GLIBCXX__)  &&  (defined(_GLIBCXX_IOSTREAM)  ||  defined(_GLIBCXX_THREAD)  ||  defined(_GLIBCXX_DEQUE))
+#error fsm_static.hpp includes <iostream>, <thread> or <deque>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+namespace {
+
+std::size_t allocations = 0;
+
+}   // namespace
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size == 0? 1 : size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace {
+
+namespace events {
+
+struct sample
+{
+    std::int32_t value;
+};
+
+struct reset
+{
+};
+
+struct threshold_exceeded
+{
+};
+
+using type = std::variant<sample, reset, threshold_exceeded>;
+
+}   // namespace events
+
+namespace states {
+
+struct idle
+{
+};
+
+struct sampling
+{
+    std::int64_t  sum   = 0;
+    std::uint32_t count = 0;
+};
+
+// holds samples back until the alarm is reset
+struct alarm
+{
+    using deferred_events = fsm::defer<events::sample>;
+};
+
+using type = std::variant<idle, sampling, alarm>;
+
+}   // namespace states
+
+class controller
+  : public fsm::static_state_machine<controller, states::type, events::type, 64>
+{
+  public:
+    auto react(states::idle &, events::sample &&event)
+    {
+        return fsm::transition_to<states::sampling>(std::int64_t(event.value), std::uint32_t(1));
+    }
+
+    fsm::stay react(states::sampling &state, events::sample &&event)
+    {
+        state.sum += event.value;
+        if (++state.count % 64 == 0  &&  state.sum > 0)
+            set_event(events::threshold_exceeded());
+        return {};
+    }
+
+    auto react(states::sampling &, events::threshold_exceeded &&)
+    {
+        return fsm::transition_to<states::alarm>();
+    }
+
+    auto react(states::alarm &, events::reset &&)
+    {
+        return fsm::transition_to<states::idle>();
+    }
+};
+
+// a machine with a queue of four events, to check that deferred events
+// are recalled in order, and none are lost, when the queue is too full to
+// take them all at once
+namespace recall {
+
+struct value { int n; };
+struct hold  { };
+struct release { };
+
+using events_t = std::variant<value, hold, release>;
+
+struct open { };
+struct held { using deferred_events = fsm::defer<value>; };
+
+using states_t = std::variant<open, held>;
+
+class machine : public fsm::static_state_machine<machine, states_t, events_t, 4>
+{
+  public:
+    fsm::stay react(open &, value &&event)
+    {
+        seen[count++] = event.n;
+        return {};
+    }
+
+    auto react(open &, hold &&)
+    {
+        return fsm::transition_to<held>();
+    }
+
+    auto react(held &, release &&)
+    {
+        return fsm::transition_to<open>();
+    }
+
+    int         seen[8] = {};
+    std::size_t count   = 0;
+};
+
+bool check()
+{
+    machine fsm;
+    fsm.set_event(hold());
+    fsm.run();
+    for (int n=0; n<4; ++n) {
+        fsm.set_event(value{n});
+        fsm.run();              // deferred
+    }
+
+    // the release leaves room for only one of the four deferred values
+    fsm.set_event(release());
+    for (int n=4; n<7; ++n)
+        fsm.set_event(value{n});
+    fsm.run();
+
+    bool in_order = fsm.count == 7;
+    for (std::size_t n=0; n<fsm.count; ++n)
+        in_order = in_order  &&  fsm.seen[n] == int(n);
+    std::printf("deferred events recalled into a full queue   %s\n", in_order? "in order" : "LOST OR OUT OF ORDER");
+    return in_order  &&  fsm.dropped_deferred_events() == 0;
+}
+
+}   // namespace recall
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    unsigned const    count  = argc > 1? std::atoi(argv[1]) : 1'000'000;
+    long long const   max_ns = argc > 2? std::atoll(argv[2]) : 0;
+
+    if (!recall::check())
+        return 1;
+
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(2 * std::size_t(count));   // handlers post some events of their own
+
+    controller fsm;
+    auto const before = allocations;
+    for (unsigned i=0; i<count; ++i) {
+        if (i % 32 == 31)
+            fsm.set_event(events::reset());
+        else
+            fsm.set_event(events::sample{std::int32_t(i % 7) - 2});
+
+        // time each step separately, including the events handlers post
+        // and deferred events they recall
+        while (fsm.queued_events() != 0) {
+            auto const start = std::chrono::steady_clock::now();
+            fsm.step();
+            latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    auto const allocated = allocations - before;
+
+    std::sort(latencies.begin(), latencies.end());
+    auto const percentile = [&latencies](double p) {
+        return latencies[std::min(latencies.size() - 1, std::size_t(p * latencies.size()))];
+    };
+
+    std::printf("%zu dispatches, %zu bytes per machine\n", latencies.size(), sizeof(controller));
+    std::printf("p50 %6lld ns   p99 %6lld ns   p99.99 %6lld ns   max %6lld ns\n",
+        (long long)percentile(0.5), (long long)percentile(0.99), (long long)percentile(0.9999), (long long)latencies.back());
+    std::printf("allocations while dispatching   %zu\n", allocated);
+    std::printf("deferred events dropped         %llu\n", (unsigned long long)fsm.dropped_deferred_events());
+
+    if (allocated != 0)
+        return 1;
+    if (max_ns != 0  &&  latencies.back() > max_ns)
+        return 1;
+    return 0;
+}
@@ -0,0 +1,158 @@
+// tokenise_file() against tokenising the whole file as one expression on
+// one thread: files that split into several parts, including ones with
+// string literals running across part boundaries, an unmatched quote, an
+// error part way through and no newline at the end, must give the same tokens and
+// errors with any number of threads, and a sink that asks must be told
+// the line and column of each token. Exits with 1 on the first
+// difference, then reports the throughput of tokenising a large file with
+// increasing numbers of threads
+//
+//     g++ -std=c++20 -O2 -march=native -pthread -I. benchmarks/tokenise_file.cpp -o tokenise_file
+//     ./tokenise_file [megabytes]
+
+#include "samples/cpp_tokeniser.hpp"
+#include "samples/parallel_tokeniser.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+
+namespace {
+
+using direct_tokeniser = tokeniser::direct_tokeniser<cpp_tokeniser::cpp_tokeniser_state_machine>;
+
+// a temporary file, removed when it goes out of scope
+class temporary_file
+{
+  public:
+    explicit temporary_file(std::string const &contents)
+    {
+        int const fd = ::mkstemp(path_);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), "mkstemp");
+        ::close(fd);
+        std::ofstream(path_, std::ios::binary) << contents;
+    }
+
+    ~temporary_file()
+    {
+        ::unlink(path_);
+    }
+
+    char const *path() const noexcept
+    {
+        return path_;
+    }
+
+  private:
+    char path_[32] = "/tmp/tokenise_file.XXXXXX";
+};
+
+struct token_output
+{
+    std::ostringstream out;
+
+    void operator()(tokeniser::token const &tok)
+    {
+        out << static_cast<int>(tok.type) << ' ' << tok.id << ' ' << tok.offset << " [" << tok.text << "]\n";
+    }
+};
+
+// as token_output, with the line and column of each token, from the
+// index tokenise_file() passes to a sink that takes one
+struct located_token_output : token_output
+{
+    void operator()(tokeniser::token const &tok, tokeniser::line_index const &lines)
+    {
+        auto const location = lines.locate(tok.offset);
+        out << location.line << ':' << location.column << ' ';
+        token_output::operator()(tok);
+    }
+};
+
+void write_error(std::ostream &out, tokeniser::tokenise_error const &error)
+{
+    out << "error " << static_cast<int>(error.type) << " at " << error.offset << ": " << error.message() << '\n';
+}
+
+bool compare(char const *name, std::string const &contents)
+{
+    temporary_file const file(contents);
+    direct_tokeniser     tokeniser;
+
+    token_output expected;
+    tokeniser.tokenise(contents, expected);
+    for (auto const &error : tokeniser.errors())
+        write_error(expected.out, error);
+
+    located_token_output        expected_located;
+    tokeniser::line_index const lines(contents);
+    tokeniser.tokenise(contents, [&expected_located, &lines](tokeniser::token const &tok) {
+        expected_located(tok, lines);
+    });
+
+    for (unsigned threads : { 1, 2, 3, 8 }) {
+        token_output tokens;
+        if (auto const error = tokeniser::tokenise_file(tokeniser, file.path(), tokens, threads))
+            write_error(tokens.out, *error);
+        if (tokens.out.str() != expected.out.str()) {
+            std::printf("%s: tokens differ with %u threads\n", name, threads);
+            return false;
+        }
+
+        located_token_output located;
+        tokeniser::tokenise_file(tokeniser, file.path(), located, threads);
+        if (located.out.str() != expected_located.out.str()) {
+            std::printf("%s: token locations differ with %u threads\n", name, threads);
+            return false;
+        }
+    }
+    std::printf("%-30s tokenised identically in parts\n", name);
+    return true;
+}
+
+std::string source_lines(std::size_t size)
+{
+    std::string source;
+    while (source.size() < size)
+        source += "int main(int const, char const * const)\n{\n    value = 0x38afe + 12.5e3 * (count << 2) - 0b1011;\n    return value >= 10;\n}\n";
+    return source;
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    auto const megabytes = argc > 1? std::strtoul(argv[1], nullptr, 10) : 256;
+
+    auto const lines = source_lines(1 << 20);
+    if (!compare("source", lines)
+    ||  !compare("multi-line string", lines + "\"a string\nacross lines\n" + std::string(1 << 18, 'x') + "\n\" " + lines)
+    ||  !compare("several multi-line strings", lines + "\"one\n\" " + lines + "\"two\n" + std::string(1 << 19, 'y') + "\n\" " + lines + "\"three\n\" " + lines)
+    ||  !compare("unmatched quote", lines + "\"" + lines)
+    ||  !compare("error", lines + "1.2.3\n" + lines)
+    ||  !compare("no newline at the end", lines + "return value")
+    ||  !compare("empty", ""))
+    {
+        return 1;
+    }
+
+    temporary_file const file(source_lines(megabytes << 20));
+    direct_tokeniser     tokeniser;
+    double               single_thread = 0;
+    auto const           cores         = std::max(std::thread::hardware_concurrency(), 1u);
+    std::printf("%u cores\n", cores);
+    for (unsigned threads=1; threads<=cores*2; threads*=2) {
+        std::size_t tokens = 0;
+        auto const start = std::chrono::steady_clock::now();
+        tokeniser::tokenise_file(tokeniser, file.path(), [&tokens](tokeniser::token const &) { ++tokens; }, threads);
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+
+        auto const rate = (megabytes << 20) / elapsed.count() / 1e6;
+        if (threads == 1)
+            single_thread = rate;
+        std::printf("%3u threads  %8.2f MB/s  %5.2fx  %zu tokens\n", threads, rate, rate / single_thread, tokens);
+    }
+}
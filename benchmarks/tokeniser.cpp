@@ -0,0 +1,312 @@
+// The direct coded tokeniser against the event driven one: both tokenise
+// the sample expressions and every line of the given source files with the
+// generic and C++ rules, and must deliver the same tokens to their sinks
+// and record the same errors. The direct tokeniser must also deliver the
+// same tokens when each expression is streamed through it in chunks of
+// random sizes. Some expressions must also give known tokens and values
+// with the C++ rules, as agreeing with each other doesn't make the
+// tokenisers right. Exits with 1 on the first difference, then reports the
+// throughput of each
+//
+//     g++ -std=c++20 -O2 -march=native -pthread -I. benchmarks/tokeniser.cpp -o tokeniser
+//     ./tokeniser [source files...]
+
+#include "samples/tokeniser.hpp"
+#include "samples/cpp_tokeniser.hpp"
+#include "samples/direct_tokeniser.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+// a token on a line, with the value of a numeric literal or the error
+// decoding it
+void write_token(std::ostream &out, tokeniser::token const &tok)
+{
+    out << static_cast<int>(tok.type) << ' ' << tok.id << ' ' << tok.offset << " [" << tok.text << "]";
+    if (auto const integer = std::get_if<std::uint64_t>(&tok.value.number))
+        out << " = " << *integer;
+    else if (auto const real = std::get_if<double>(&tok.value.number))
+        out << " = " << *real;
+    else if (tok.value.error != std::errc())
+        out << " error " << static_cast<int>(tok.value.error);
+    out << '\n';
+}
+
+// the errors recorded by the tokeniser, one per line
+template<typename Tokeniser>
+void write_errors(std::ostream &out, Tokeniser const &tokeniser)
+{
+    for (auto const &error : tokeniser.errors())
+        out << "error " << static_cast<int>(error.type) << " at " << error.offset << ": " << error.message() << '\n';
+}
+
+// the tokens, one per line, followed by the errors
+template<typename Tokeniser>
+std::string tokenise(Tokeniser &tokeniser, std::string_view expr)
+{
+    std::ostringstream out;
+    tokeniser.tokenise(expr, [&out](tokeniser::token const &tok) {
+        write_token(out, tok);
+    });
+    write_errors(out, tokeniser);
+    return out.str();
+}
+
+// as tokenise() above, streaming the expression in chunks of up to
+// max_chunk characters
+template<typename StateMachine>
+std::string tokenise_in_chunks(tokeniser::direct_tokeniser<StateMachine> &tokeniser, std::string_view expr, std::size_t max_chunk, std::mt19937 &random)
+{
+    std::ostringstream out;
+    auto sink = [&out](tokeniser::token const &tok) {
+        write_token(out, tok);
+    };
+    while (!expr.empty()) {
+        auto const size = std::uniform_int_distribution<std::size_t>(0, max_chunk)(random);
+        auto const chunk = expr.substr(0, size);
+        tokeniser.feed(std::string(chunk), sink);   // a copy, so tokens can't point into expr
+        expr.remove_prefix(chunk.size());
+    }
+    tokeniser.finish(sink);
+    write_errors(out, tokeniser);
+    return out.str();
+}
+
+template<typename StateMachine>
+bool compare(char const *name, std::vector<std::string> const &corpus)
+{
+    StateMachine                                event_driven;
+    tokeniser::direct_tokeniser<StateMachine>   direct;
+    std::mt19937                                random(1);
+
+    for (auto const &expr : corpus) {
+        auto const expected = tokenise(event_driven, expr);
+        auto const actual   = tokenise(direct, expr);
+        if (actual != expected) {
+            std::printf("%s tokenisers differ on \"%s\"\nevent driven:\n%s\ndirect:\n%s\n", name, expr.c_str(), expected.c_str(), actual.c_str());
+            return false;
+        }
+
+        for (std::size_t max_chunk : { 1, 2, 3, 7, 64 }) {
+            auto const streamed = tokenise_in_chunks(direct, expr, max_chunk, random);
+            if (streamed != expected) {
+                std::printf("%s streamed tokens differ on \"%s\" in chunks of up to %zu\nwhole:\n%s\nstreamed:\n%s\n", name, expr.c_str(), max_chunk, expected.c_str(), streamed.c_str());
+                return false;
+            }
+        }
+    }
+    std::printf("%-10s %zu expressions tokenised identically, whole and streamed\n", name, corpus.size());
+    return true;
+}
+
+// a token an expression must give, with the value of a numeric literal or
+// the error decoding it
+struct expected_token
+{
+    tokeniser::token_type       type;
+    std::int32_t                id;
+    std::string_view            text;
+    tokeniser::literal_value    value = {};
+};
+
+template<typename Tokeniser>
+bool check(char const *name, Tokeniser &tokeniser, std::string_view expr, std::vector<expected_token> const &expected)
+{
+    std::vector<tokeniser::token> tokens;
+    tokeniser.tokenise(expr, [&tokens](tokeniser::token const &tok) {
+        tokens.push_back(tok);
+    });
+
+    bool same = tokens.size() == expected.size();
+    for (std::size_t i=0; same  &&  i<tokens.size(); ++i) {
+        same = tokens[i].type         == expected[i].type
+           &&  tokens[i].id           == expected[i].id
+           &&  tokens[i].text         == expected[i].text
+           &&  tokens[i].value.number == expected[i].value.number
+           &&  tokens[i].value.error  == expected[i].value.error;
+    }
+    if (!same) {
+        std::ostringstream out;
+        for (auto const &tok : tokens)
+            write_token(out, tok);
+        std::printf("%s tokeniser gives unexpected tokens for \"%.*s\":\n%s\n", name, int(expr.size()), expr.data(), out.str().c_str());
+    }
+    return same;
+}
+
+// expressions tokenised with the C++ rules, and the tokens they must give
+bool check_expected()
+{
+    using type    = tokeniser::token_type;
+    using value   = tokeniser::literal_value;
+    using keyword = cpp_tokeniser::cpp_tokeniser_state_machine::keyword_type;
+    using op      = cpp_tokeniser::cpp_tokeniser_state_machine::operator_type;
+
+    std::vector<std::pair<std::string_view, std::vector<expected_token>>> const cases = {
+        { "0x10 017 18446744073709551616 1E", {
+            { type::hex_literal,     -1, "10",                   value{ std::uint64_t(16) } },
+            { type::oct_literal,     -1, "017",                  value{ std::uint64_t(15) } },
+            { type::numeric_literal, -1, "18446744073709551616", value{ {}, std::errc::result_out_of_range } },
+            { type::dec_literal,     -1, "1E",                   value{ {}, std::errc::invalid_argument } },
+        } },
+        // a keyword is only recognised as a whole token
+        { "integer int document", {
+            { type::symbol,  -1,                             "integer" },
+            { type::keyword, std::int32_t(keyword::kw_int),  "int" },
+            { type::symbol,  -1,                             "document" },
+        } },
+        // the longest operator is taken, and a prefix of a longer one that
+        // isn't there ends where the longest valid one does
+        { "t... a->*b u..", {
+            { type::symbol,         -1,                             "t" },
+            { type::operator_token, std::int32_t(op::ellipsis),     "..." },
+            { type::symbol,         -1,                             "a" },
+            { type::operator_token, std::int32_t(op::arrow_star),   "->*" },
+            { type::symbol,         -1,                             "b" },
+            { type::symbol,         -1,                             "u" },
+            { type::operator_token, std::int32_t(op::period),       "." },
+            { type::operator_token, std::int32_t(op::period),       "." },
+        } },
+    };
+
+    cpp_tokeniser::cpp_tokeniser_state_machine                               event_driven;
+    tokeniser::direct_tokeniser<cpp_tokeniser::cpp_tokeniser_state_machine> direct;
+    for (auto const &[expr, expected] : cases) {
+        if (!check("event driven", event_driven, expr, expected)
+        ||  !check("direct", direct, expr, expected))
+        {
+            return false;
+        }
+    }
+    std::printf("%-10s %zu expressions tokenised as expected\n", "c++", cases.size());
+    return true;
+}
+
+// a sink that uses every field of the tokens, so that the work of making
+// them can't be optimised away
+struct checksum
+{
+    std::size_t sum = 0;
+
+    void operator()(tokeniser::token const &tok) noexcept
+    {
+        sum += static_cast<std::size_t>(tok.type) + tok.id + tok.offset + tok.text.size() + tok.value.number.index();
+    }
+};
+
+std::size_t volatile total_checksum;
+
+template<typename Tokeniser>
+double megabytes_per_second(Tokeniser &tokeniser, std::string_view source, unsigned repeat)
+{
+    checksum sink;
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<repeat; ++i)
+        tokeniser.tokenise(source, sink);
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+    total_checksum = total_checksum + sink.sum;
+    return source.size() * double(repeat) / elapsed.count() / 1e6;
+}
+
+// streams the source through the tokeniser repeat times over, in chunks
+template<typename StateMachine>
+double streamed_megabytes_per_second(tokeniser::direct_tokeniser<StateMachine> &tokeniser, std::string_view source, unsigned repeat, std::size_t chunk_size)
+{
+    checksum sink;
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<repeat; ++i) {
+        for (std::size_t offset=0; offset<source.size(); offset+=chunk_size)
+            tokeniser.feed(source.substr(offset, chunk_size), sink);
+    }
+    tokeniser.finish(sink);
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+    total_checksum = total_checksum + sink.sum;
+    return source.size() * double(repeat) / elapsed.count() / 1e6;
+}
+
+// tokenises expressions that each end in an error, which is recorded
+// without formatting a message
+template<typename Tokeniser>
+double errors_per_second(Tokeniser &tokeniser, std::vector<std::string> const &expressions, unsigned repeat)
+{
+    checksum    sink;
+    std::size_t errors = 0;
+    auto const start = std::chrono::steady_clock::now();
+    for (unsigned i=0; i<repeat; ++i) {
+        for (auto const &expr : expressions) {
+            tokeniser.tokenise(expr, sink);
+            errors += tokeniser.errors().size();
+        }
+    }
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - start;
+    total_checksum = total_checksum + sink.sum;
+    return errors / elapsed.count();
+}
+
+}   // namespace
+
+int main(int argc, char *argv[])
+{
+    std::vector<std::string> corpus = {
+        "0", "0.3", "4e3", ".3e4", "0e3", ".1e-12", ".1e+8", "12.5", "2.5", ".5", "5.",
+        "01", "12345", "678 ", " 90", " 123 456 ", "1+2", "0x38afe", "0b101001", "01723",
+        "123*0x2+ 0b10 / 19.234\t- 29^2", "1234.6789.2", " 123x 45 678", "++", "0b", "0x", "1E+5",
+        "next.empty()", "operator<<", "operator>>()", "(*(++next))++",
+        "int main(int const, char const * const)\n{\n}",
+        "'a' \"string\" \"unterminated", "#include <map>", "a\n  b\n    1.2.3", "intx document do", "p->q->*r .*s t... u.. v-->w",
+        "18446744073709551615 18446744073709551616 0xffffffffffffffff 0x10000000000000000 1e308 1e999 1E 0b 01777", "caf\xc3\xa9 = \xc3\xa9t\xc3\xa9",
+    };
+
+    // tokens that run on across many chunks when streamed
+    for (std::string const &part : { std::string(300, 'q'), std::string(300, '7') }) {
+        corpus.push_back("x = \"" + part + "\" + sym" + part + " - 0x" + std::string(300, 'f'));
+        corpus.push_back("1." + part + "e+" + std::string(200, '3') + " \"" + part);
+    }
+
+    std::vector<char const *> files(argv + 1, argv + argc);
+    if (files.empty())
+        files = { "samples/tokeniser.hpp", "samples/cpp_tokeniser.hpp", "include/fsm.hpp" };
+    for (auto file : files) {
+        std::ifstream in(file);
+        for (std::string line; std::getline(in, line); ) {
+            if (!line.empty()  &&  line.back() == '\r')
+                line.pop_back();
+            corpus.push_back(line);
+        }
+    }
+
+    if (!compare<tokeniser::state_machine>("generic", corpus)
+    ||  !compare<cpp_tokeniser::cpp_tokeniser_state_machine>("c++", corpus)
+    ||  !check_expected())
+    {
+        return 1;
+    }
+
+    // an expression that tokenises without errors
+    std::string source;
+    while (source.size() < (1 << 20))
+        source += "int main(int const, char const * const)\n{\n    value = 0x38afe + 12.5e3 * (count << 2) - 0b1011;\n    return value >= 10;\n}\n";
+
+    tokeniser::state_machine                                                 generic;
+    cpp_tokeniser::cpp_tokeniser_state_machine                               cpp;
+    tokeniser::direct_tokeniser<tokeniser::state_machine>                    generic_direct;
+    tokeniser::direct_tokeniser<cpp_tokeniser::cpp_tokeniser_state_machine> cpp_direct;
+    std::printf("event driven, generic rules   %8.2f MB/s\n", megabytes_per_second(generic, std::string_view(source).substr(0, 64 << 10), 1));
+    std::printf("event driven, c++ rules       %8.2f MB/s\n", megabytes_per_second(cpp, std::string_view(source).substr(0, 64 << 10), 1));
+    std::printf("direct, generic rules         %8.2f MB/s\n", megabytes_per_second(generic_direct, source, 20));
+    std::printf("direct, c++ rules             %8.2f MB/s\n", megabytes_per_second(cpp_direct, source, 20));
+    std::printf("streamed, generic rules       %8.2f MB/s\n", streamed_megabytes_per_second(generic_direct, source, 20, 64 << 10));
+    std::printf("streamed, c++ rules           %8.2f MB/s\n", streamed_megabytes_per_second(cpp_direct, source, 20, 64 << 10));
+
+    std::vector<std::string> invalid(1000);
+    for (std::size_t i=0; i<invalid.size(); ++i)
+        invalid[i] = "value = " + std::to_string(i) + ".5.1 + count";
+    std::printf("event driven, invalid input   %8.0f errors/s\n", errors_per_second(cpp, invalid, 1));
+    std::printf("direct, invalid input         %8.0f errors/s\n", errors_per_second(cpp_direct, invalid, 100));
+}
@@ -1,225 +1,1234 @@
-#pragma once
-
-#include <chrono>
-#include <deque>
-#include <functional>   // std::bind
-#include <iostream>
-#include <mutex>
-#include <thread>
-#include <type_traits>
-#include <variant>
-
-namespace fsm {
-
-namespace detail {
-
-// std::visit helper
-template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
-template<class... Ts> overload(Ts...)->overload<Ts...>;
-
-#ifndef NDEBUG
-template <typename V, int ... Is>
-void print_variant_types_helper(std::integer_sequence<int, Is...> const &)
-{
-    using unused = int[];
-    (void)unused{
-        0,
-        (std::cout << typeid(std::variant_alternative_t<Is, V>).name() << '\n', 0)...};
-}
-
-template <typename V>
-void print_variant_types()
-{
-    print_variant_types_helper<V>(std::make_integer_sequence<int, std::variant_size_v<V>>{});
-}
-#endif  // NDEBUG
-
-}   // namespace detail
-
-template<typename Derived, typename State, typename Event, bool DebugTrace=false>
-class state_machine
-{
-  private:
-    using event_t = Event;
-    using state_t = State;
-    using derived_t = Derived;
-
-  public:
-    // make the state machine non-copyable, non-movable
-    state_machine(state_machine &&)                 = delete;
-    state_machine &operator=(state_machine &&)      = delete;
-    state_machine(state_machine const &)            = delete;
-    state_machine &operator=(state_machine const &) = delete;
-
-    state_machine()
-    {
-        event_thread_ = std::thread(std::bind(&state_machine::event_thread, this));
-    }
-
-    ~state_machine()
-    {
-        terminate_ = true;
-        if (event_thread_.joinable())
-            event_thread_.join();
-    }
-
-    void set_event(event_t &&event)
-    {
-        std::scoped_lock lock(event_queue_mutex_);
-        event_queue_.push_back(std::forward<event_t>(event));
-    }
-
-    void wait_for_empty_event_queue() const
-    {
-        using namespace std::literals::chrono_literals;
-
-        while (true) {
-            event_queue_mutex_.lock();
-            bool empty = event_queue_.empty();
-            event_queue_mutex_.unlock();
-
-            if (empty)
-                return;
-            std::this_thread::sleep_for(5ms);
-        }
-    }
-
-    template<typename State, typename Fn>
-    void async_wait_for_state(Fn fn) const
-    {
-        using namespace std::literals::chrono_literals;
-
-        std::thread([this, fn] {
-            while (!std::holds_alternative<State>(current_state_))
-                std::this_thread::sleep_for(5ms);
-            fn();
-        }).detach();
-    }
-
-  protected:
-    void event_thread()
-    {
-        using namespace std::literals::chrono_literals;
-
-        while (!terminate_) {
-            bool queue_empty = true;
-            do {
-                // empty() and pop() are both noexcept, so we don't need the
-                // security of RAII, and using it would make the code less
-                // readable with redundant scope blocks
-                event_queue_mutex_.lock();
-                queue_empty = event_queue_.empty();
-                event_queue_mutex_.unlock();
-
-                if (terminate_)
-                    return;
-                else if (queue_empty)
-                    std::this_thread::sleep_for(5ms);
-            } while (queue_empty);
-
-            try {
-                // process the event, leaving it in the queue so
-                // other threads can wait on the queue being empty
-                // to determine processing has finished in some
-                // implementations
-                event_t event(std::move(event_queue_.front()));
-                process_event(std::move(event));
-
-                event_queue_mutex_.lock();
-                event_queue_.pop_front();
-                event_queue_mutex_.unlock();
-            }
-            catch (std::exception &)
-            {
-            }
-        }
-    }
-
-    void process_event(event_t &&event)
-    {
-        auto fn = [instance = reinterpret_cast<derived_t *>(this)](auto &&state, auto &&event) -> state_t {
-            if constexpr (DebugTrace)
-                std::cout << "\033[95m" << typeid(event).name() << "\033[0m\n    ";
-
-            return instance->on_event(
-                std::move(state),
-                std::move(event));
-        };
-
-        auto &&new_state = std::visit(detail::overload{ fn }, current_state_, event);
-
-        bool const state_changed = (new_state.index() != current_state_.index());
-        std::visit(
-            detail::overload{[this, state_changed](auto &&state){ transition(state, state_changed); } },
-            new_state);
-    }
-
-    state_t on_event(auto &&state, auto &&event)
-    {
-#ifndef NDEBUG
-        std::cout << "\033[31mUnknown state/event combination\n";
-        std::cout << "    " << typeid(state).name() << '\t' << typeid(state).raw_name() << '\n';
-        std::cout << "    " << typeid(event).name() << '\t' << typeid(event).raw_name() << '\n';
-        std::cout << "\033[0m";
-#endif  // NDEBUG
-        return std::move(state);
-    }
-
-  private:
-    void debug_output_transition(auto &new_state)
-    {
-        std::visit(
-            [&new_state](auto &&type) {
-                std::cout << "\033[93m"
-                          << typeid(type).name() << " --> "
-                          << typeid(new_state).name()
-                          << "\033[0m\n";
-            },
-            current_state_);
-    }
-    void transition(auto &&new_state, bool const state_changed)
-    {
-        if constexpr (DebugTrace)
-            debug_output_transition(new_state);
-
-        auto instance = reinterpret_cast<derived_t *>(this);
-        if (state_changed)
-        {
-            std::visit(
-                [this](auto &state){
-                    auto instance = reinterpret_cast<derived_t *>(this);
-                    if constexpr (requires { state.leave(*instance); })
-                        state.leave(*instance);
-                },
-                current_state_);
-
-            current_state_ = std::move(new_state);
-
-            std::visit(
-                [this](auto &state){
-                    auto instance = reinterpret_cast<derived_t *>(this);
-                    if constexpr (requires { state.enter(*instance); })
-                        state.enter(*instance);
-                },
-                current_state_);
-        }
-        else
-        {
-            // if the state hasn't changed, we call reenter() instead of
-            // leave() followed by enter().
-            // this gives the FSM implementer a choice of how to handle
-            // re-entry
-            if constexpr (requires { new_state.reenter(*instance); })
-                new_state.reenter(*instance);
-        }
-    }
-
-  private:
-    bool                terminate_ = false;
-    state_t             current_state_;
-    std::mutex mutable  event_queue_mutex_;
-    std::thread         event_thread_;
-    std::deque<event_t> event_queue_;
-};
-
-}
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>   // std::bind
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <variant>
+#include <vector>
+
+#include "fsm_core.hpp"
+
+#if defined(_M_X64)  ||  defined(_M_IX86)  ||  defined(__x86_64__)  ||  defined(__i386__)
+#include <immintrin.h>
+#elif defined(_M_ARM64)
+#include <intrin.h>
+#endif
+
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace fsm {
+
+namespace detail {
+
+// single writer, multiple reader sequence lock. readers never block the
+// writer, and retry if the value changed while they were copying it
+template<typename T>
+class seqlock
+{
+    static_assert(std::is_trivially_copyable_v<T>);
+
+  public:
+    explicit seqlock(T const &value) noexcept
+    {
+        store(value);
+    }
+
+    void store(T const &value) noexcept
+    {
+        std::uint64_t buffer[word_count] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+
+        auto const seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        for (std::size_t i=0; i<word_count; ++i)
+            words_[i].store(buffer[i], std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    T load() const noexcept
+    {
+        std::uint64_t buffer[word_count];
+        std::uint64_t seq;
+        do {
+            seq = seq_.load(std::memory_order_acquire);
+            for (std::size_t i=0; i<word_count; ++i)
+                buffer[i] = words_[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) != 0  ||  seq != seq_.load(std::memory_order_relaxed));
+
+        T value;
+        std::memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+
+  private:
+    static constexpr std::size_t word_count = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+
+    std::atomic<std::uint64_t> seq_{0};
+    std::atomic<std::uint64_t> words_[word_count];
+};
+
+// tell the CPU we're in a spin loop, which saves power and lets a
+// sibling hyperthread run
+inline void cpu_relax() noexcept
+{
+#if defined(_M_X64)  ||  defined(_M_IX86)  ||  defined(__x86_64__)  ||  defined(__i386__)
+    _mm_pause();
+#elif defined(_M_ARM64)
+    __yield();
+#elif defined(__aarch64__)  ||  defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+struct no_snapshot
+{
+    template<typename T>
+    explicit no_snapshot(T const &) noexcept
+    {
+    }
+};
+
+#ifndef NDEBUG
+template <typename V, int ... Is>
+void print_variant_types_helper(std::integer_sequence<int, Is...> const &)
+{
+    using unused = int[];
+    (void)unused{
+        0,
+        (std::cout << typeid(std::variant_alternative_t<Is, V>).name() << '\n', 0)...};
+}
+
+template <typename V>
+void print_variant_types()
+{
+    print_variant_types_helper<V>(std::make_integer_sequence<int, std::variant_size_v<V>>{});
+}
+#endif  // NDEBUG
+
+}   // namespace detail
+
+// What set_event() does with an event the current state has no handler
+// for. the check is only made while the queue is empty, as events already
+// queued may change the state before the new event is dispatched; events
+// that get past it are counted when they are dispatched
+enum class unhandled_policy
+{
+    dispatch,   // queue it as usual
+    drop,       // discard it, and return false from set_event()
+    reject,     // discard it, and throw fsm::unhandled_event
+};
+
+class unhandled_event : public std::logic_error
+{
+  public:
+    unhandled_event(std::size_t state_index, std::size_t event_index)
+      : std::logic_error("event has no handler in the current state"),
+        state_index_(state_index),
+        event_index_(event_index)
+    {
+    }
+
+    std::size_t state_index() const noexcept
+    {
+        return state_index_;
+    }
+
+    std::size_t event_index() const noexcept
+    {
+        return event_index_;
+    }
+
+  private:
+    std::size_t state_index_;
+    std::size_t event_index_;
+};
+
+// The clock used for scheduled events. steady_clock runs in real time,
+// virtual_clock simulates time by jumping to the next scheduled deadline
+// whenever the state machine is idle, so timed machines can be run far
+// faster than real time
+struct steady_clock
+{
+    using duration   = std::chrono::steady_clock::duration;
+    using time_point = std::chrono::steady_clock::time_point;
+
+    static constexpr bool is_virtual = false;
+
+    time_point now() const noexcept
+    {
+        return std::chrono::steady_clock::now();
+    }
+};
+
+class virtual_clock
+{
+  public:
+    using duration   = std::chrono::nanoseconds;
+    using time_point = std::chrono::time_point<virtual_clock, duration>;
+
+    static constexpr bool is_virtual = true;
+
+    time_point now() const noexcept
+    {
+        return now_.load(std::memory_order_acquire);
+    }
+
+    void advance_to(time_point time) noexcept
+    {
+        if (time > now())
+            now_.store(time, std::memory_order_release);
+    }
+
+    // back to the start of simulated time
+    void rewind() noexcept
+    {
+        now_.store(time_point(), std::memory_order_release);
+    }
+
+  private:
+    std::atomic<time_point> now_{};
+};
+
+template<typename Derived, typename State, typename Event, bool DebugTrace=false, typename Clock=steady_clock>
+class state_machine
+{
+  private:
+    using event_t = Event;
+    using state_t = State;
+    using derived_t = Derived;
+
+    template<typename S>
+    struct has_deferred_events;
+
+    template<typename... States>
+    struct has_deferred_events<std::variant<States...>>
+      : std::bool_constant<(requires { typename States::deferred_events; }  ||  ...)>
+    {
+    };
+
+    static constexpr bool has_deferring_states = has_deferred_events<state_t>::value;
+
+    // small, trivially copyable state variants can also be published
+    // through a sequence lock so other threads can read a consistent copy.
+    // see state_snapshot()
+    static constexpr bool can_snapshot_state = std::is_trivially_copyable_v<state_t>
+                                            && std::is_default_constructible_v<state_t>
+                                            && sizeof(state_t) <= 64;
+
+    using snapshot_t = std::conditional_t<can_snapshot_state, detail::seqlock<state_t>, detail::no_snapshot>;
+
+  public:
+    using event_type = Event;
+    using state_type = State;
+    using clock_type = Clock;
+
+    // make the state machine non-copyable, non-movable
+    state_machine(state_machine &&)                 = delete;
+    state_machine &operator=(state_machine &&)      = delete;
+    state_machine(state_machine const &)            = delete;
+    state_machine &operator=(state_machine const &) = delete;
+
+    // the event thread isn't started until the first event is posted, so
+    // machines that are never sent an event, or are only replayed, don't
+    // pay for a thread
+    state_machine()
+    {
+        if constexpr (snapshots_state())
+            state_snapshot_ = std::make_unique<snapshot_t>(current_state_);
+    }
+
+    ~state_machine()
+    {
+        {
+            std::scoped_lock lock(event_queue_mutex_);
+            terminate_ = true;
+            posted_.store(posted_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+        event_available_.notify_all();
+
+        if (event_thread_.joinable())
+            event_thread_.join();
+
+#if defined(__linux__)
+        if (event_fd_ != -1)
+            ::close(event_fd_);
+#endif
+        delete unhandled_counts_.load(std::memory_order_relaxed);
+    }
+
+    // returns false if the event was not queued
+    bool set_event(event_t &&event)
+    {
+        auto const replaying = replaying_.load(std::memory_order_relaxed);
+        if (replaying == replay_mode::delivered)
+            return false;
+
+        std::scoped_lock lock(event_queue_mutex_);
+        if (resetting_)
+            return false;
+
+        if (unhandled_policy_ != unhandled_policy::dispatch
+        &&  event_queue_.empty()
+        &&  !handles(current_state_.index(), event.index()))
+        {
+            count_unhandled(current_state_.index(), event.index());
+            if (unhandled_policy_ == unhandled_policy::reject)
+                throw unhandled_event(current_state_.index(), event.index());
+            return false;
+        }
+
+        if (replaying == replay_mode::accepted) {
+            // the journal holds the event where the handler posted it
+            replay_posts_.push_back(event.index());
+            event_queue_.push_back(std::forward<event_t>(event));
+            return true;
+        }
+
+        start_event_thread();
+        notify_accepted(event, dispatching_thread_ == std::this_thread::get_id());
+        event_queue_.push_back(std::forward<event_t>(event));
+        notify_work();
+        return true;
+    }
+
+    void set_unhandled_policy(unhandled_policy policy)
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        unhandled_policy_ = policy;
+    }
+
+    // whether state S has a handler for, or defers, event E, worked out at
+    // compile time
+    template<typename S, typename E>
+    static constexpr bool handles()
+    {
+        return has_handler<S, E>()  ||  defers_event<S, E>();
+    }
+
+    static bool handles(std::size_t state_index, std::size_t event_index) noexcept
+    {
+        static constexpr auto table = make_pair_table(
+            []<typename S, typename E>() { return handles<S, E>(); },
+            std::make_index_sequence<std::variant_size_v<state_t>>(),
+            std::make_index_sequence<std::variant_size_v<event_t>>());
+        return table[state_index][event_index];
+    }
+
+    // the number of events of each state/event pair without a handler that
+    // have been dispatched, dropped or rejected. Derived opts in with
+    //     static constexpr bool count_unhandled_events = true;
+    // and the table of counts is only allocated once there is something
+    // to count
+    std::uint64_t unhandled_count(std::size_t state_index, std::size_t event_index) const noexcept
+    {
+        static_assert(counts_unhandled_events(), "Derived must opt in to unhandled event counts");
+        auto const counts = unhandled_counts_.load(std::memory_order_acquire);
+        return counts == nullptr? 0 : (*counts)[state_index][event_index].load(std::memory_order_relaxed);
+    }
+
+    template<typename S, typename E>
+    std::uint64_t unhandled_count() const noexcept
+    {
+        return unhandled_count(detail::variant_index<S, state_t>::value, detail::variant_index<E, event_t>::value);
+    }
+
+    // post an event once the delay has elapsed on the state machine's clock
+    template<typename Rep, typename Period>
+    void schedule_event(std::chrono::duration<Rep, Period> delay, event_t &&event)
+    {
+        if (replaying_.load(std::memory_order_relaxed) != replay_mode::off)
+            return;
+
+        std::scoped_lock lock(event_queue_mutex_);
+        if (resetting_)
+            return;
+
+        start_event_thread();
+        timers_.push_back({
+            clock_.now() + std::chrono::duration_cast<typename Clock::duration>(delay),
+            timer_sequence_++,
+            std::forward<event_t>(event)});
+        std::push_heap(timers_.begin(), timers_.end(), &timer::later);
+        notify_work();
+    }
+
+    // run the machine from the caller's own event loop rather than its
+    // event thread, which is never started. events are dispatched by
+    // poll_once(), and on Linux event_fd() can be added to an epoll set to
+    // find out when to call it. must be called before the first event
+    void use_external_loop()
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        assert(!event_thread_.joinable());
+        external_loop_ = true;
+    }
+
+    bool external_loop() const
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        return external_loop_;
+    }
+
+#if defined(__linux__)
+    // an eventfd that is readable while the machine has events to dispatch,
+    // or after a timer has been scheduled, so the loop can recalculate its
+    // timeout from next_timer_deadline(). poll_once() resets it
+    int event_fd()
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        assert(external_loop_);
+        if (event_fd_ == -1) {
+            event_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (event_fd_ == -1)
+                throw std::system_error(errno, std::generic_category(), "eventfd");
+            if (!event_queue_.empty()  ||  !timers_.empty())
+                signal_event_fd();
+        }
+        return event_fd_;
+    }
+#endif
+
+    // dispatch up to max_events queued or due events on the calling thread,
+    // for machines driven by an external loop. returns the number of events
+    // dispatched
+    std::size_t poll_once(std::size_t max_events = std::numeric_limits<std::size_t>::max())
+    {
+        std::unique_lock lock(event_queue_mutex_);
+        assert(external_loop_);
+        clear_event_fd();
+
+        std::size_t dispatched = 0;
+        while (dispatched < max_events) {
+            if (!timers_.empty())
+                release_due_timers();
+
+            if (event_queue_.empty()) {
+                if constexpr (Clock::is_virtual) {
+                    if (!timers_.empty()) {
+                        clock_.advance_to(timers_.front().deadline);
+                        continue;
+                    }
+                }
+                break;
+            }
+
+            dispatch_front(lock);
+            ++dispatched;
+        }
+
+        // keep the descriptor readable while there is more to do
+        if (!event_queue_.empty())
+            signal_event_fd();
+        return dispatched;
+    }
+
+    // when the loop next needs to call poll_once() for a timer
+    std::optional<typename Clock::time_point> next_timer_deadline() const
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        if (timers_.empty())
+            return std::nullopt;
+        return timers_.front().deadline;
+    }
+
+    void wait_for_empty_event_queue() const
+    {
+        std::unique_lock lock(event_queue_mutex_);
+        queue_drained_.wait(lock, [this] { return event_queue_.empty(); });
+    }
+
+    // wait until there are no events queued and no timers pending
+    void wait_for_idle() const
+    {
+        std::unique_lock lock(event_queue_mutex_);
+        queue_drained_.wait(lock, [this] { return event_queue_.empty()  &&  timers_.empty(); });
+    }
+
+    Clock &clock() noexcept
+    {
+        return clock_;
+    }
+
+    // low latency mode. when the queue empties, the event thread spins
+    // waiting for the next event for up to spin_limit before parking on the
+    // condition variable, so events posted while it spins are picked up
+    // without a wake up. the default never parks, and needs a core to
+    // itself; see fsm_thread.hpp to pin the event thread. zero turns
+    // spinning off
+    void set_busy_poll(std::chrono::nanoseconds spin_limit = std::chrono::nanoseconds::max()) noexcept
+    {
+        spin_limit_.store(spin_limit.count(), std::memory_order_relaxed);
+    }
+
+    // starts the event thread if it isn't running yet. a machine driven by
+    // an external loop has no event thread
+    std::thread::native_handle_type event_thread_handle()
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        assert(!external_loop_);
+        start_event_thread();
+        return event_thread_.native_handle();
+    }
+
+    // a copy of the current state if the machine has nothing left to do:
+    // no queued or deferred events and no pending timers. the machine can
+    // then be destroyed and later recreated from the copy with
+    // restore_state(), provided no other thread posts to it in between
+    std::optional<state_t> idle_state() const
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        if (!event_queue_.empty()  ||  !deferred_events_.empty()  ||  !timers_.empty())
+            return std::nullopt;
+        return current_state_;
+    }
+
+    // return the machine to its initial state so it can be reused without
+    // the cost of creating a new one, and its thread. events that haven't
+    // been dispatched yet, deferred events and pending timers are
+    // discarded, and the event being dispatched, if any, is allowed to
+    // finish first; events and timers its handler posts are discarded too.
+    // no other thread may post events while the machine resets. the
+    // initial state is constructed without calling enter(), as it is on
+    // construction, and a virtual clock is rewound. Derived can reset its
+    // own members in
+    //     void on_reset();
+    // which is called last. machines driven by an external loop must not
+    // be reset during poll_once()
+    void reset()
+    {
+        std::unique_lock lock(event_queue_mutex_);
+        resetting_ = true;
+        if (external_loop_) {
+            event_queue_.clear();
+            clear_event_fd();
+        }
+        else if (!event_queue_.empty())
+            event_queue_.erase(std::next(event_queue_.begin()), event_queue_.end());
+        timers_.clear();
+        queue_drained_.wait(lock, [this] { return event_queue_.empty(); });
+
+        deferred_events_.clear();
+        timer_sequence_ = 0;
+        if constexpr (Clock::is_virtual)
+            clock_.rewind();
+        if (auto const counts = unhandled_counts_.load(std::memory_order_relaxed)) {
+            for (auto &row : *counts) {
+                for (auto &count : row)
+                    count.store(0, std::memory_order_relaxed);
+            }
+        }
+        replaying_.store(replay_mode::off, std::memory_order_relaxed);
+        replay_posts_.clear();
+        current_state_ = state_t();
+        publish_state();
+        resetting_ = false;
+        lock.unlock();
+
+        auto instance = reinterpret_cast<derived_t *>(this);
+        if constexpr (requires { instance->on_reset(); })
+            instance->on_reset();
+    }
+
+    // observe each event as it is delivered, along with the index of the
+    // state it is delivered to. add observers before posting events
+    void add_dispatch_observer(std::function<void(event_t const &, std::size_t)> observer)
+    {
+        dispatch_observers_.push_back(std::move(observer));
+    }
+
+    // observe each event as it is queued, by set_event() or a timer, in
+    // the order they are queued. from_handler is true for events posted by
+    // the machine's own handlers, and idle_state is the current state if
+    // the machine has nothing queued, deferred or scheduled, and null
+    // otherwise. observers are called with the event queue locked, so
+    // must not post events. an observer that throws rejects the event:
+    // set_event() throws, and the event of a timer is dropped. add
+    // observers before posting events
+    void add_accept_observer(std::function<void(event_t const &, bool from_handler, state_t const *idle_state)> observer)
+    {
+        accept_observers_.push_back(std::move(observer));
+    }
+
+    // deliver a recorded event on the calling thread, bypassing the queue,
+    // and return the index of the state it was delivered to.
+    // the machine stays in replay mode from then on, discarding events
+    // posted by states because the recording already holds them at the
+    // point they were delivered
+    std::size_t replay_event(event_t &&event)
+    {
+        replaying_.store(replay_mode::delivered, std::memory_order_relaxed);
+
+        auto const index = current_state_.index();
+        process_event(std::move(event));
+        return index;
+    }
+
+    // queue a journalled event that was posted by another thread or
+    // released by a timer, without dispatching it. the machine stays in
+    // replay mode, as with replay_event(), and timers scheduled by states
+    // are discarded, as the journal holds them at the point they fired
+    void replay_accepted_event(event_t &&event)
+    {
+        replaying_.store(replay_mode::accepted, std::memory_order_relaxed);
+
+        std::scoped_lock lock(event_queue_mutex_);
+        event_queue_.push_back(std::move(event));
+    }
+
+    // dispatch queued events on the calling thread until a handler posts
+    // the journalled event that a handler posted at this point. returns
+    // false if the queue runs dry first or a different event is posted
+    bool replay_posted_event(std::size_t event_index)
+    {
+        replaying_.store(replay_mode::accepted, std::memory_order_relaxed);
+
+        std::unique_lock lock(event_queue_mutex_);
+        while (replay_posts_.empty()  &&  !event_queue_.empty())
+            dispatch_front(lock);
+        if (replay_posts_.empty())
+            return false;
+
+        auto const posted = replay_posts_.front();
+        replay_posts_.pop_front();
+        return posted == event_index;
+    }
+
+    // leave replay mode once a recovered machine has caught up, so events
+    // posted by states and scheduled timers are processed again. journalled
+    // events still queued are dispatched as usual
+    void finish_replay()
+    {
+        std::scoped_lock lock(event_queue_mutex_);
+        replaying_.store(replay_mode::off, std::memory_order_relaxed);
+        replay_posts_.clear();
+        if (!event_queue_.empty()) {
+            start_event_thread();
+            notify_work();
+        }
+    }
+
+    // replace the current state without calling leave() or enter(), to
+    // resume from a saved snapshot. only valid before any events are posted
+    void restore_state(state_t const &state)
+    {
+        current_state_ = state;
+        publish_state();
+    }
+
+    template<typename S, typename Fn>
+    void async_wait_for_state(Fn fn) const
+    {
+        using namespace std::literals::chrono_literals;
+
+        std::thread([this, fn] {
+            while (!is_in<S>())
+                std::this_thread::sleep_for(5ms);
+            fn();
+        }).detach();
+    }
+
+    // the index of the current state in the state variant. wait-free and
+    // safe to call from any thread
+    std::size_t current_state_index() const noexcept
+    {
+        return state_index_.load(std::memory_order_acquire);
+    }
+
+    template<typename S>
+    bool is_in() const noexcept
+    {
+        static_assert(detail::variant_index<S, state_t>::value != std::variant_npos, "S is not a state of this machine");
+        return current_state_index() == detail::variant_index<S, state_t>::value;
+    }
+
+    // a consistent copy of the current state, safe to call from any thread.
+    // Derived opts in with
+    //     static constexpr bool snapshot_state = true;
+    // which costs a copy of the state on every transition, so the state
+    // variant must be trivially copyable, default constructible and no
+    // more than 64 bytes
+    state_t state_snapshot() const noexcept
+    {
+        static_assert(snapshots_state(), "Derived must opt in to state snapshots");
+        return state_snapshot_->load();
+    }
+
+  protected:
+    void event_thread()
+    {
+        std::unique_lock lock(event_queue_mutex_);
+        while (!terminate_) {
+            if (!timers_.empty())
+                release_due_timers();
+
+            if (event_queue_.empty()) {
+                if (timers_.empty()  ||  !Clock::is_virtual) {
+                    if (spin_for_event(lock))
+                        continue;
+                }
+
+                if (timers_.empty())
+                    event_available_.wait(lock);
+                else if constexpr (Clock::is_virtual) {
+                    // nothing can happen before the next deadline, so
+                    // simulated time jumps straight to it
+                    clock_.advance_to(timers_.front().deadline);
+                }
+                else
+                    event_available_.wait_until(lock, timers_.front().deadline);
+                continue;
+            }
+
+            dispatch_front(lock);
+        }
+    }
+
+    // the event queue mutex must be held, and the queue not empty
+    void dispatch_front(std::unique_lock<std::mutex> &lock)
+    {
+        // process the event, leaving it in the queue so
+        // other threads can wait on the queue being empty
+        // to determine processing has finished in some
+        // implementations
+        event_t event(std::move(event_queue_.front()));
+        dispatching_thread_ = std::this_thread::get_id();
+        lock.unlock();
+        try {
+            process_event(std::move(event));
+        }
+        catch (std::exception &)
+        {
+        }
+        lock.lock();
+        dispatching_thread_ = {};
+
+        event_queue_.pop_front();
+        if (event_queue_.empty())
+            queue_drained_.notify_all();
+    }
+
+    void process_event(event_t &&event)
+    {
+        // a state constructor that threw during a transition left the
+        // machine without a state, and there is nothing to dispatch to.
+        // both kinds of dispatch fail as std::visit does
+        if (current_state_.valueless_by_exception()) {
+            publish_state();
+            throw std::bad_variant_access();
+        }
+
+        for (auto const &observer : dispatch_observers_)
+            observer(event, current_state_.index());
+
+        if constexpr (has_deferring_states) {
+            if (is_deferred(event)) {
+                deferred_events_.push_back(std::move(event));
+                return;
+            }
+        }
+
+        if constexpr (uses_reduced_dispatch()) {
+            // only state/event pairs with a handler instantiate dispatch(),
+            // every other pair shares a single fallback
+            static constexpr auto table = make_dispatch_table(
+                std::make_index_sequence<std::variant_size_v<state_t>>(),
+                std::make_index_sequence<std::variant_size_v<event_t>>());
+            (this->*table[current_state_.index()][event.index()])(event);
+        }
+        else {
+            std::visit(
+                [this](auto &state, auto &event) { dispatch(state, std::move(event)); },
+                current_state_, event);
+        }
+
+        publish_state();
+    }
+
+    // the fallback for state/event pairs without a handler, which are
+    // counted rather than reported. see unhandled_count()
+    unhandled on_event(auto &&, auto &&)
+    {
+        return {};
+    }
+
+  private:
+    enum class replay_mode : std::uint8_t
+    {
+        off,
+        delivered,  // recorded events are dispatched directly
+        accepted,   // journalled events are queued
+    };
+
+    struct timer
+    {
+        typename Clock::time_point deadline;
+        std::uint64_t              sequence;
+        event_t                    event;
+
+        // order timers by deadline, and timers with the same deadline in
+        // the order they were scheduled
+        static bool later(timer const &lhs, timer const &rhs) noexcept
+        {
+            return std::tie(lhs.deadline, lhs.sequence) > std::tie(rhs.deadline, rhs.sequence);
+        }
+    };
+
+    // move timers whose deadline has passed on to the event queue.
+    // the event queue mutex must be held
+    void release_due_timers()
+    {
+        auto const now = clock_.now();
+        while (!timers_.empty()  &&  timers_.front().deadline <= now) {
+            std::pop_heap(timers_.begin(), timers_.end(), &timer::later);
+            event_t event(std::move(timers_.back().event));
+            timers_.pop_back();
+            try {
+                notify_accepted(event, false);
+            }
+            catch (std::exception &)
+            {
+                continue;
+            }
+            event_queue_.push_back(std::move(event));
+        }
+    }
+
+    // the event queue mutex must be held
+    void notify_accepted(event_t const &event, bool from_handler)
+    {
+        if (accept_observers_.empty())
+            return;
+
+        bool const idle = event_queue_.empty()  &&  deferred_events_.empty()  &&  timers_.empty();
+        for (auto const &observer : accept_observers_)
+            observer(event, from_handler, idle? &current_state_ : nullptr);
+    }
+
+    // the event queue mutex must be held
+    void start_event_thread()
+    {
+        if (!external_loop_  &&  !event_thread_.joinable())
+            event_thread_ = std::thread(std::bind(&state_machine::event_thread, this));
+    }
+
+    // wake whatever dispatches events. the event queue mutex must be held
+    void notify_work()
+    {
+        posted_.store(posted_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (external_loop_)
+            signal_event_fd();
+        else
+            event_available_.notify_one();
+    }
+
+    // the event queue mutex must be held
+    void signal_event_fd()
+    {
+#if defined(__linux__)
+        if (event_fd_ != -1  &&  !event_fd_signalled_) {
+            std::uint64_t const one = 1;
+            [[maybe_unused]] auto const written = ::write(event_fd_, &one, sizeof(one));
+            event_fd_signalled_ = true;
+        }
+#endif
+    }
+
+    // the event queue mutex must be held
+    void clear_event_fd()
+    {
+#if defined(__linux__)
+        if (event_fd_signalled_) {
+            std::uint64_t count;
+            [[maybe_unused]] auto const read = ::read(event_fd_, &count, sizeof(count));
+            event_fd_signalled_ = false;
+        }
+#endif
+    }
+
+    // busy poll for a posted event or a due timer without holding the lock.
+    // returns false if the spin limit passed with nothing to do
+    bool spin_for_event(std::unique_lock<std::mutex> &lock)
+    {
+        auto const limit = spin_limit_.load(std::memory_order_relaxed);
+        if (limit == 0)
+            return false;
+
+        auto const seen      = posted_.load(std::memory_order_relaxed);
+        auto const has_timer = !timers_.empty();
+        auto const deadline  = has_timer? timers_.front().deadline : typename Clock::time_point();
+        auto const start     = std::chrono::steady_clock::now();
+        lock.unlock();
+
+        bool timer_due = false;
+        for (unsigned spins=1; posted_.load(std::memory_order_relaxed) == seen; ++spins) {
+            detail::cpu_relax();
+
+            // reading the clock costs more than a pause, so only check the
+            // deadlines now and again
+            if (spins % 64 == 0) {
+                if (has_timer  &&  clock_.now() >= deadline) {
+                    timer_due = true;
+                    break;
+                }
+                if (limit != std::chrono::nanoseconds::max().count()
+                &&  std::chrono::steady_clock::now() - start >= std::chrono::nanoseconds(limit))
+                {
+                    break;
+                }
+            }
+        }
+
+        // an event posted after the spin gave up has already notified, so
+        // it must be picked up here rather than by waiting
+        lock.lock();
+        return timer_due  ||  posted_.load(std::memory_order_relaxed) != seen;
+    }
+
+    void publish_state() noexcept
+    {
+        state_index_.store(current_state_.index(), std::memory_order_release);
+        if constexpr (snapshots_state())
+            state_snapshot_->store(current_state_);
+    }
+
+    bool is_deferred(event_t const &event) const
+    {
+        static constexpr auto table = make_pair_table(
+            []<typename S, typename E>() { return defers_event<S, E>(); },
+            std::make_index_sequence<std::variant_size_v<state_t>>(),
+            std::make_index_sequence<std::variant_size_v<event_t>>());
+        return table[current_state_.index()][event.index()];
+    }
+
+    // a [state][event] table of Fn<S, E>() for every state/event pair
+    template<typename Fn, std::size_t... Ss, std::size_t... Es>
+    static constexpr auto make_pair_table(Fn fn, std::index_sequence<Ss...>, std::index_sequence<Es...>)
+    {
+        auto row = [fn]<std::size_t S>(std::integral_constant<std::size_t, S>) {
+            using state_type = std::variant_alternative_t<S, state_t>;
+            return std::array{ fn.template operator()<state_type, std::variant_alternative_t<Es, event_t>>()... };
+        };
+        // spell out the element type, as class template argument deduction
+        // would copy a single row rather than wrap it
+        using row_t = decltype(row(std::integral_constant<std::size_t, 0>()));
+        return std::array<row_t, sizeof...(Ss)>{ row(std::integral_constant<std::size_t, Ss>())... };
+    }
+
+    // Derived opts in to table dispatch with
+    //     static constexpr bool reduced_dispatch = true;
+    // which compiles faster and smaller for large state/event matrices
+    static constexpr bool uses_reduced_dispatch()
+    {
+        if constexpr (requires { Derived::reduced_dispatch; })
+            return Derived::reduced_dispatch;
+        else
+            return false;
+    }
+
+    static constexpr bool snapshots_state()
+    {
+        if constexpr (requires { Derived::snapshot_state; }) {
+            static_assert(!Derived::snapshot_state  ||  can_snapshot_state,
+                          "state snapshots need a trivially copyable, default constructible state variant of at most 64 bytes");
+            return Derived::snapshot_state;
+        }
+        else
+            return false;
+    }
+
+    static constexpr bool counts_unhandled_events()
+    {
+        if constexpr (requires { Derived::count_unhandled_events; })
+            return Derived::count_unhandled_events;
+        else
+            return false;
+    }
+
+    template<typename S, typename E>
+    static constexpr bool has_handler()
+    {
+        if constexpr (requires(derived_t &fsm, S &state, E &&event) { fsm.react(state, std::move(event)); })
+            return true;
+        else
+            return !std::is_same_v<
+                decltype(std::declval<derived_t &>().on_event(std::declval<S &&>(), std::declval<E &&>())),
+                unhandled>;
+    }
+
+    using dispatch_entry_t = void (state_machine::*)(event_t &);
+
+    template<std::size_t S, std::size_t E>
+    void dispatch_entry(event_t &event)
+    {
+        dispatch(*std::get_if<S>(&current_state_), std::move(*std::get_if<E>(&event)));
+    }
+
+    void dispatch_unhandled(event_t &event)
+    {
+        count_unhandled(current_state_.index(), event.index());
+        std::visit(
+            [this](auto &state) {
+                if constexpr (DebugTrace)
+                    debug_output_unhandled(state);
+                reenter(state);
+            },
+            current_state_);
+    }
+
+    void count_unhandled(std::size_t state_index, std::size_t event_index) noexcept
+    {
+        if constexpr (counts_unhandled_events()) {
+            auto counts = unhandled_counts_.load(std::memory_order_acquire);
+            if (counts == nullptr) {
+                // posting threads and the event thread may race to allocate
+                auto const allocated = new (std::nothrow) unhandled_counts_t{};
+                if (allocated == nullptr)
+                    return;
+                if (unhandled_counts_.compare_exchange_strong(counts, allocated, std::memory_order_acq_rel))
+                    counts = allocated;
+                else
+                    delete allocated;
+            }
+            (*counts)[state_index][event_index].fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    template<std::size_t... Ss, std::size_t... Es>
+    static constexpr auto make_dispatch_table(std::index_sequence<Ss...>, std::index_sequence<Es...>)
+    {
+        auto entry = []<std::size_t S, std::size_t E>() -> dispatch_entry_t {
+            if constexpr (has_handler<std::variant_alternative_t<S, state_t>, std::variant_alternative_t<E, event_t>>())
+                return &state_machine::dispatch_entry<S, E>;
+            else
+                return &state_machine::dispatch_unhandled;
+        };
+        auto row = [entry]<std::size_t S>(std::integral_constant<std::size_t, S>) {
+            return std::array{ entry.template operator()<S, Es>()... };
+        };
+        // spell out the element type, as class template argument deduction
+        // would copy a single row rather than wrap it
+        using row_t = decltype(row(std::integral_constant<std::size_t, 0>()));
+        return std::array<row_t, sizeof...(Ss)>{ row(std::integral_constant<std::size_t, Ss>())... };
+    }
+
+    void recall_deferred_events()
+    {
+        // re-inject events that the new state doesn't defer immediately after
+        // the event being processed, which is still at the front of the queue.
+        // they arrived before anything else in the queue, so this preserves
+        // the original ordering
+        std::scoped_lock lock(event_queue_mutex_);
+        if (resetting_)
+            return;
+
+        auto pos = event_queue_.empty()? event_queue_.end() : std::next(event_queue_.begin());
+        for (auto it=deferred_events_.begin(); it!=deferred_events_.end(); ) {
+            if (is_deferred(*it))
+                ++it;
+            else if (replaying_.load(std::memory_order_relaxed) == replay_mode::delivered)    // the recording already holds it
+                it = deferred_events_.erase(it);
+            else {
+                pos = std::next(event_queue_.insert(pos, std::move(*it)));
+                it  = deferred_events_.erase(it);
+            }
+        }
+    }
+
+    void debug_output_transition(state_t const &new_state)
+    {
+        std::visit(
+            [this](auto const &state) { debug_output_transition<std::decay_t<decltype(state)>>(); },
+            new_state);
+    }
+
+    void debug_output_unhandled(auto const &state)
+    {
+        std::cout << "\033[31munhandled in " << typeid(state).name() << "\033[0m\n";
+    }
+
+    template<typename NewState>
+    void debug_output_transition()
+    {
+        std::visit(
+            [](auto &&type) {
+                std::cout << "\033[93m"
+                          << typeid(type).name() << " --> "
+                          << typeid(NewState).name()
+                          << "\033[0m\n";
+            },
+            current_state_);
+    }
+
+    template<typename S, typename E>
+    void dispatch(S &state, E &&event)
+    {
+        auto instance = reinterpret_cast<derived_t *>(this);
+
+        if constexpr (DebugTrace)
+            std::cout << "\033[95m" << typeid(event).name() << "\033[0m\n    ";
+
+        if constexpr (!has_handler<S, std::decay_t<E>>()) {
+            count_unhandled(detail::variant_index<S, state_t>::value, detail::variant_index<std::decay_t<E>, event_t>::value);
+            if constexpr (DebugTrace)
+                debug_output_unhandled(state);
+        }
+
+        // prefer an in-place handler, which avoids moving the state in and
+        // out of the handler for every event
+        if constexpr (requires { instance->react(state, std::move(event)); })
+            apply_transition(state, instance->react(state, std::move(event)));
+        else
+            apply_transition(state, instance->on_event(std::move(state), std::move(event)));
+    }
+
+    template<typename S>
+    void apply_transition(S &state, unhandled)
+    {
+        reenter(state);
+    }
+
+    template<typename S>
+    void apply_transition(S &state, stay)
+    {
+        if constexpr (DebugTrace)
+            debug_output_transition<S>();
+
+        reenter(state);
+    }
+
+    template<typename S, typename T, typename... Args>
+    void apply_transition(S &state, go_to<T, Args...> &&next)
+    {
+        if constexpr (DebugTrace)
+            debug_output_transition<T>();
+
+        if constexpr (std::is_same_v<S, T>) {
+            std::apply(
+                [this](auto &&...args) { current_state_.template emplace<T>(std::move(args)...); },
+                std::move(next.args));
+            reenter(std::get<T>(current_state_));
+        }
+        else {
+            leave(state);
+            std::apply(
+                [this](auto &&...args) { current_state_.template emplace<T>(std::move(args)...); },
+                std::move(next.args));
+            enter(std::get<T>(current_state_));
+        }
+    }
+
+    template<typename S>
+    void apply_transition(S &state, state_t &&new_state)
+    {
+        if constexpr (DebugTrace)
+            debug_output_transition(new_state);
+
+        bool const state_changed = (new_state.index() != current_state_.index());
+        if (state_changed)
+            leave(state);
+        change_state(std::move(new_state), state_changed);
+    }
+
+    // not a template on the current state, so the visit over the new state
+    // is instantiated once rather than for every state/event pair
+    void change_state(state_t &&new_state, bool const state_changed)
+    {
+        current_state_ = std::move(new_state);
+        std::visit(
+            [this, state_changed](auto &state) {
+                if (state_changed)
+                    enter(state);
+                else
+                    reenter(state);
+            },
+            current_state_);
+    }
+
+    void enter(auto &state)
+    {
+        auto instance = reinterpret_cast<derived_t *>(this);
+        if constexpr (requires { state.enter(*instance); })
+            state.enter(*instance);
+
+        if constexpr (has_deferring_states) {
+            if (!deferred_events_.empty())
+                recall_deferred_events();
+        }
+    }
+
+    void leave(auto &state)
+    {
+        auto instance = reinterpret_cast<derived_t *>(this);
+        if constexpr (requires { state.leave(*instance); })
+            state.leave(*instance);
+    }
+
+    void reenter(auto &state)
+    {
+        // if the state hasn't changed, we call reenter() instead of
+        // leave() followed by enter().
+        // this gives the FSM implementer a choice of how to handle
+        // re-entry
+        auto instance = reinterpret_cast<derived_t *>(this);
+        if constexpr (requires { state.reenter(*instance); })
+            state.reenter(*instance);
+    }
+
+  private:
+    bool                            terminate_ = false;
+    bool                            resetting_ = false;    // events posted meanwhile are discarded
+    std::atomic<replay_mode>        replaying_{replay_mode::off};     // read by threads posting events
+    std::deque<std::size_t>         replay_posts_;      // events posted by handlers in a journal replay
+    std::thread::id                 dispatching_thread_;
+    state_t                         current_state_;
+    std::atomic<std::size_t>        state_index_{current_state_.index()};
+    std::unique_ptr<snapshot_t>     state_snapshot_;    // if Derived opts in
+    Clock                           clock_;
+    std::mutex mutable              event_queue_mutex_;
+    std::condition_variable         event_available_;
+    std::condition_variable mutable queue_drained_;
+    std::thread                     event_thread_;
+    std::deque<event_t>             event_queue_;
+    std::deque<event_t>             deferred_events_;
+    std::vector<timer>              timers_;       // min-heap on deadline
+    std::uint64_t                   timer_sequence_ = 0;
+    std::atomic<std::uint64_t>      posted_{0};    // bumped whenever the event thread has work
+    std::atomic<std::int64_t>       spin_limit_{0};
+    unhandled_policy                unhandled_policy_ = unhandled_policy::dispatch;
+    bool                            external_loop_ = false;
+#if defined(__linux__)
+    int                             event_fd_ = -1;
+    bool                            event_fd_signalled_ = false;
+#endif
+
+    using unhandled_counts_t = std::array<std::array<std::atomic<std::uint64_t>, std::variant_size_v<event_t>>, std::variant_size_v<state_t>>;
+    std::atomic<unhandled_counts_t *> unhandled_counts_{nullptr};     // allocated by the first count
+
+    std::vector<std::function<void(event_t const &, std::size_t)>>           dispatch_observers_;
+    std::vector<std::function<void(event_t const &, bool, state_t const *)>> accept_observers_;
+};
+
+}
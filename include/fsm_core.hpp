@@ -0,0 +1,93 @@
+#pragma once
+
+// The parts of the library that don't depend on threads, I/O or the heap:
+// transition descriptors, deferral declarations and variant helpers. They
+// are shared by state_machine and static_state_machine
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace fsm {
+
+namespace detail {
+
+// std::visit helper
+template<class... Ts> struct overload : Ts... { using Ts::operator()...; };
+template<class... Ts> overload(Ts...)->overload<Ts...>;
+
+// index of an alternative within a std::variant
+template<typename T, typename V>
+struct variant_index;
+
+template<typename T, typename... Ts>
+struct variant_index<T, std::variant<Ts...>>
+{
+    static constexpr std::size_t value = []{
+        constexpr bool matches[] = { std::is_same_v<T, Ts>... };
+        for (std::size_t i=0; i<sizeof...(Ts); ++i) {
+            if (matches[i])
+                return i;
+        }
+        return std::variant_npos;
+    }();
+};
+
+}   // namespace detail
+
+// States postpone events they cannot act on yet by declaring
+//     using deferred_events = fsm::defer<events::press_button>;
+// Deferred events are held by the state machine and re-injected, in the
+// order they arrived, when it enters a state that does not defer them
+template<typename... Events>
+struct defer
+{
+    template<typename Event>
+    static constexpr bool contains = (std::is_same_v<std::decay_t<Event>, Events>  ||  ...);
+};
+
+template<typename State, typename Event>
+constexpr bool defers_event()
+{
+    if constexpr (requires { typename State::deferred_events; })
+        return State::deferred_events::template contains<Event>;
+    else
+        return false;
+}
+
+// Transition descriptors returned by in-place event handlers
+//     fsm::stay react(states::red &state, events::press_button &&event);
+//     auto      react(states::green &state, events::press_button &&event)
+//     {
+//         return fsm::transition_to<states::green_button_pressed>(10s);
+//     }
+// react() mutates the current state through the reference. Returning
+// fsm::stay keeps the state and calls reenter(), transition_to<T>() leaves
+// the current state and constructs T in place from the given arguments.
+// If T's constructor throws, the machine is left without a state, and
+// every event dispatched after that throws std::bad_variant_access
+struct stay
+{
+};
+
+template<typename State, typename... Args>
+struct go_to
+{
+    std::tuple<Args...> args;
+};
+
+template<typename State, typename... Args>
+go_to<State, std::decay_t<Args>...> transition_to(Args &&...args)
+{
+    return { std::tuple<std::decay_t<Args>...>(std::forward<Args>(args)...) };
+}
+
+// returned by the default on_event() for state/event pairs that have no
+// handler, which lets the state machine tell them apart at compile time
+struct unhandled
+{
+};
+
+}   // namespace fsm
@@ -0,0 +1,371 @@
+#pragma once
+
+#include "fsm.hpp"
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <span>
+#include <tuple>
+#include <vector>
+
+#if defined(__AVX2__)  ||  defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+namespace fsm {
+
+// Ensemble simulation
+//
+// Runs many independent instances of one state machine in lockstep, for
+// what-if simulations. Instances are stored as a structure of arrays: one
+// byte of state index per instance, plus an array of state data for each
+// state type that isn't empty. Events are applied to every instance in a
+// single pass on the calling thread
+//
+//     fsm::ensemble<crossing_state_machine> crossings(500'000);
+//     crossings.apply(events::press_button());            // broadcast
+//     crossings.apply(std::span(per_instance_events));    // one each
+//
+// The ensemble reuses the machine's handlers, calling them on a single
+// prototype machine, but simulates transitions only: enter(), leave()
+// and reenter() are not called, and events the handlers post are not
+// delivered to the instances.
+//
+// A handler between empty states whose return type is fsm::stay or
+// fsm::go_to<T> with no arguments has a transition that is known at
+// compile time. The ensemble treats such handlers as pure and doesn't
+// call them: those transitions become a lookup table over state indices,
+// which is applied 16 or 32 instances at a time with a byte shuffle when
+// the machine has at most 16 states and SSSE3 or AVX2 is enabled. Every
+// other state/event pair is dispatched per instance, with the state
+// loaded from and stored back to its array
+template<typename StateMachine>
+class ensemble
+{
+    using event_t = typename StateMachine::event_type;
+    using state_t = typename StateMachine::state_type;
+
+    static constexpr std::size_t state_count = std::variant_size_v<state_t>;
+    static constexpr std::size_t event_count = std::variant_size_v<event_t>;
+    static_assert(state_count <= 0xff, "ensemble state indices are stored in a byte");
+
+    template<typename S>
+    static constexpr std::uint8_t index_of = static_cast<std::uint8_t>(detail::variant_index<S, state_t>::value);
+
+    // the state/event pair needs its handler called
+    static constexpr std::uint8_t dynamic = 0xff;
+
+  public:
+    // every instance starts in the initial state
+    explicit ensemble(std::size_t size)
+      : index_(size, 0)
+    {
+        std::apply(
+            [size](auto &...fields) {
+                (resize_fields(fields, size), ...);
+            },
+            fields_);
+    }
+
+    std::size_t size() const noexcept
+    {
+        return index_.size();
+    }
+
+    std::size_t state_index(std::size_t instance) const noexcept
+    {
+        return index_[instance];
+    }
+
+    state_t state(std::size_t instance) const
+    {
+        return load_state(instance, std::make_index_sequence<state_count>());
+    }
+
+    // the number of instances in each state
+    std::array<std::size_t, state_count> census() const noexcept
+    {
+        std::array<std::size_t, state_count> counts{};
+        for (auto index : index_)
+            ++counts[index];
+        return counts;
+    }
+
+    // the prototype machine the handlers are called on
+    StateMachine &machine() noexcept
+    {
+        return machine_;
+    }
+
+    // deliver the same event to every instance
+    template<typename E>
+        requires (detail::variant_index<E, event_t>::value != std::variant_npos)
+    void apply(E const &event)
+    {
+        static constexpr auto table = make_table<E>(std::make_index_sequence<state_count>());
+
+        std::uint8_t *indices = index_.data();
+        std::size_t const size = index_.size();
+        std::size_t i = 0;
+        if constexpr (state_count <= 16)
+            i = apply_simd(table, indices, size, event);
+
+        for (; i<size; ++i) {
+            auto const next = table.next[indices[i]];
+            if (next == dynamic)
+                (this->*table.dispatch[indices[i]])(i, event);
+            else
+                indices[i] = next;
+        }
+    }
+
+    void apply(event_t const &event)
+    {
+        std::visit([this](auto const &e) { apply(e); }, event);
+    }
+
+    // deliver events[i] to instance i. there must be an event for every
+    // instance
+    void apply(std::span<event_t const> events)
+    {
+        static constexpr auto tables = make_tables(std::make_index_sequence<event_count>());
+
+        assert(events.size() == index_.size());
+        for (std::size_t i=0; i<events.size(); ++i) {
+            auto const &table = tables[events[i].index()];
+            auto const next   = table.next[index_[i]];
+            if (next == dynamic)
+                (this->*table.dispatch[index_[i]])(i, events[i]);
+            else
+                index_[i] = next;
+        }
+    }
+
+  private:
+    template<typename Event>
+    struct transition_table
+    {
+        using dispatch_t = void (ensemble::*)(std::size_t, Event const &);
+
+        std::array<std::uint8_t, state_count> next;     // index of the next state, or dynamic
+        std::array<dispatch_t,   state_count> dispatch;
+    };
+
+    template<typename S>
+    static void resize_fields(std::vector<S> &fields, std::size_t size)
+    {
+        if constexpr (!std::is_empty_v<S>)
+            fields.resize(size);
+    }
+
+    template<typename S, typename E>
+    static decltype(auto) invoke(StateMachine &fsm, S &state, E &&event)
+    {
+        if constexpr (requires { fsm.react(state, std::move(event)); })
+            return fsm.react(state, std::move(event));
+        else if constexpr (requires { fsm.on_event(std::move(state), std::move(event)); })
+            return fsm.on_event(std::move(state), std::move(event));
+        else
+            return unhandled();
+    }
+
+    template<typename T>
+    struct plain_go_to : std::false_type
+    {
+    };
+
+    template<typename T>
+    struct plain_go_to<go_to<T>> : std::true_type
+    {
+        using target = T;
+    };
+
+    // the index of the state the pair always transitions to, or dynamic if
+    // the handler has to be called to find out
+    template<typename S, typename E>
+    static constexpr std::uint8_t static_next()
+    {
+        using result_t = std::decay_t<decltype(invoke(std::declval<StateMachine &>(), std::declval<S &>(), std::declval<E>()))>;
+
+        if constexpr (std::is_same_v<result_t, unhandled>)
+            return index_of<S>;
+        else if constexpr (std::is_same_v<result_t, stay>)
+            return std::is_empty_v<S>? index_of<S> : dynamic;
+        else if constexpr (plain_go_to<result_t>::value) {
+            using target_t = typename plain_go_to<result_t>::target;
+            return std::is_empty_v<S>  &&  std::is_empty_v<target_t>? index_of<target_t> : dynamic;
+        }
+        else
+            return dynamic;
+    }
+
+    template<typename E, std::size_t... Ss>
+    static constexpr auto make_table(std::index_sequence<Ss...>)
+    {
+        transition_table<E> table{
+            { static_next<std::variant_alternative_t<Ss, state_t>, E>()... },
+            { &ensemble::dispatch<std::variant_alternative_t<Ss, state_t>, E>... }
+        };
+        return table;
+    }
+
+    template<std::size_t... Es>
+    static constexpr auto make_tables(std::index_sequence<Es...>)
+    {
+        return std::array<transition_table<event_t>, event_count>{
+            make_variant_table<std::variant_alternative_t<Es, event_t>>(std::make_index_sequence<state_count>())...
+        };
+    }
+
+    template<typename E, std::size_t... Ss>
+    static constexpr transition_table<event_t> make_variant_table(std::index_sequence<Ss...>)
+    {
+        return {
+            { static_next<std::variant_alternative_t<Ss, state_t>, E>()... },
+            { &ensemble::dispatch_variant<std::variant_alternative_t<Ss, state_t>, E>... }
+        };
+    }
+
+    // apply the lookup table to a block of instances at a time, handing
+    // the instances in dynamic states to their handlers. returns the
+    // number of instances done
+    template<typename E>
+    std::size_t apply_simd([[maybe_unused]] transition_table<E> const &table,
+                           [[maybe_unused]] std::uint8_t *indices,
+                           [[maybe_unused]] std::size_t size,
+                           [[maybe_unused]] E const &event)
+    {
+        std::size_t i = 0;
+#if defined(__AVX2__)  ||  defined(__SSSE3__)
+        // pshufb looks up each byte in a 16 entry table
+        alignas(16) std::uint8_t next[16]    = {};
+        alignas(16) std::uint8_t is_dyn[16]  = {};
+        for (std::size_t s=0; s<state_count; ++s) {
+            next[s]   = table.next[s] == dynamic? std::uint8_t(s) : table.next[s];
+            is_dyn[s] = table.next[s] == dynamic? 0x80 : 0;
+        }
+        auto const next_lut = _mm_load_si128(reinterpret_cast<__m128i const *>(next));
+        auto const dyn_lut  = _mm_load_si128(reinterpret_cast<__m128i const *>(is_dyn));
+
+#if defined(__AVX2__)
+        constexpr std::size_t lanes = 32;
+        auto const next_lut256 = _mm256_broadcastsi128_si256(next_lut);
+        auto const dyn_lut256  = _mm256_broadcastsi128_si256(dyn_lut);
+#else
+        constexpr std::size_t lanes = 16;
+#endif
+
+        alignas(32) std::uint8_t before[lanes];
+        for (; i + lanes <= size; i += lanes) {
+#if defined(__AVX2__)
+            auto const current = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(indices + i));
+            auto mask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_shuffle_epi8(dyn_lut256, current)));
+            if (mask != 0)
+                _mm256_store_si256(reinterpret_cast<__m256i *>(before), current);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(indices + i), _mm256_shuffle_epi8(next_lut256, current));
+#else
+            auto const current = _mm_loadu_si128(reinterpret_cast<__m128i const *>(indices + i));
+            auto mask = static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_shuffle_epi8(dyn_lut, current)));
+            if (mask != 0)
+                _mm_store_si128(reinterpret_cast<__m128i *>(before), current);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(indices + i), _mm_shuffle_epi8(next_lut, current));
+#endif
+            while (mask != 0) {
+                auto const lane = std::countr_zero(mask);
+                mask &= mask - 1;
+                (this->*table.dispatch[before[lane]])(i + lane, event);
+            }
+        }
+#endif
+        return i;
+    }
+
+    template<typename S>
+    S load(std::size_t instance) const
+    {
+        if constexpr (std::is_empty_v<S>)
+            return S();
+        else
+            return std::get<std::vector<S>>(fields_)[instance];
+    }
+
+    template<typename S>
+    void store(std::size_t instance, S &&state)
+    {
+        using state_type = std::decay_t<S>;
+        if constexpr (!std::is_empty_v<state_type>)
+            std::get<std::vector<state_type>>(fields_)[instance] = std::forward<S>(state);
+        index_[instance] = index_of<state_type>;
+    }
+
+    template<std::size_t... Ss>
+    state_t load_state(std::size_t instance, std::index_sequence<Ss...>) const
+    {
+        using loader_t = state_t (ensemble::*)(std::size_t) const;
+        static constexpr loader_t loaders[] = { &ensemble::load_variant<Ss>... };
+        return (this->*loaders[index_[instance]])(instance);
+    }
+
+    template<std::size_t S>
+    state_t load_variant(std::size_t instance) const
+    {
+        return state_t(std::in_place_index<S>, load<std::variant_alternative_t<S, state_t>>(instance));
+    }
+
+    template<typename S, typename E>
+    void dispatch(std::size_t instance, E const &event)
+    {
+        if constexpr (static_next<S, E>() == dynamic) {
+            S state = load<S>(instance);
+            E copy(event);
+            apply_result(instance, state, invoke(machine_, state, std::move(copy)));
+        }
+    }
+
+    template<typename S, typename E>
+    void dispatch_variant(std::size_t instance, event_t const &event)
+    {
+        dispatch<S, E>(instance, *std::get_if<E>(&event));
+    }
+
+    template<typename S>
+    void apply_result(std::size_t, S &, unhandled)
+    {
+    }
+
+    template<typename S>
+    void apply_result(std::size_t instance, S &state, stay)
+    {
+        // react() may have updated the state in place
+        store(instance, std::move(state));
+    }
+
+    template<typename S, typename T, typename... Args>
+    void apply_result(std::size_t instance, S &, go_to<T, Args...> &&next)
+    {
+        store(instance, std::make_from_tuple<T>(std::move(next.args)));
+    }
+
+    template<typename S>
+    void apply_result(std::size_t instance, S &, state_t &&next)
+    {
+        std::visit([this, instance](auto &&state) { store(instance, std::move(state)); }, std::move(next));
+    }
+
+  private:
+    template<typename S>
+    struct fields;
+
+    template<typename... States>
+    struct fields<std::variant<States...>>
+    {
+        using type = std::tuple<std::vector<States>...>;
+    };
+
+    StateMachine                                machine_;
+    std::vector<std::uint8_t>                   index_;
+    typename fields<state_t>::type              fields_;
+};
+
+}   // namespace fsm
@@ -0,0 +1,521 @@
+#pragma once
+
+#if defined(_WIN32)
+#error "fsm_journal.hpp requires POSIX file I/O"
+#endif
+
+#include "fsm_recorder.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <streambuf>
+#include <string>
+#include <system_error>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fsm {
+
+// Write-ahead event journal
+//
+// Appends every event a state machine accepts to a log file as it is
+// queued, whether posted with set_event() or released by a timer, in the
+// event recorder's binary format. Events waiting in the queue are in the
+// journal, so recovery queues them again, and events posted by handlers
+// mark how far dispatch had got, so recovery dispatches up to the same
+// point and the handlers post them again. Records are buffered and written by a
+// commit thread, which gathers everything appended within the commit
+// interval into one write() and one fdatasync(), so the cost of
+// durability is shared by every event in the batch
+//
+//     // on start up, before any events are posted
+//     fsm::event_journal<events_t> journal("crossing.journal");
+//     journal.attach(crossing, 10'000);     // snapshot every 10k events
+//     auto result = fsm::recover(crossing, "crossing.journal");
+//     journal.post(crossing, events::press_button());
+//
+// set_event() returns, and the event may be dispatched, before its record
+// is durable, so a crash loses at most the last commit interval of events,
+// including any the machine has already acted on. post() blocks until the
+// record is on disk, so an event it has returned for survives a crash.
+// flush() waits for everything appended so far.
+//
+// Once a commit fails the journal is broken, and every later append()
+// throws the error, so set_event() throws rather than accept an event it
+// can't journal, and the event of a timer is dropped. A snapshot that
+// fails to write only leaves recovery with more of the journal to replay,
+// so commits go on, and the error is kept for snapshot_error()
+//
+// If the machine's state is trivially copyable, attach() can also write a
+// snapshot of the state to <path>.snapshot, the first time the machine is
+// idle when an event is queued after every n records, so recovery only
+// replays the journal written since. Timers that haven't fired yet are
+// not journalled, and are not restored by recovery
+//
+// Each record holds the time on the machine's clock since the one before,
+// which recovery uses to move a virtual_clock on. The first record each
+// attach() appends has no time, as the clock of an earlier run, or the
+// time recovery has moved it on to, may not be the one it is on now
+
+namespace detail {
+
+// appends everything written through an ostream to a byte vector
+class byte_buffer_streambuf : public std::streambuf
+{
+  public:
+    std::vector<char> &bytes() noexcept
+    {
+        return bytes_;
+    }
+
+  protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+            bytes_.push_back(traits_type::to_char_type(ch));
+        return traits_type::not_eof(ch);
+    }
+
+    std::streamsize xsputn(char const *s, std::streamsize count) override
+    {
+        bytes_.insert(bytes_.end(), s, s + count);
+        return count;
+    }
+
+  private:
+    std::vector<char> bytes_;
+};
+
+struct snapshot_header
+{
+    static constexpr char          magic_value[4] = { 'F', 'S', 'M', 'S' };
+    static constexpr std::uint32_t version_value  = 2;
+
+    char          magic[4];
+    std::uint32_t version;
+    std::uint64_t state_size;
+    std::uint64_t records;      // journal records the snapshot includes
+    std::uint64_t log_offset;   // offset of the first record after them
+};
+
+inline std::vector<char> read_file(int fd)
+{
+    std::vector<char> contents;
+    char buffer[65536];
+    for (;;) {
+        auto const count = ::read(fd, buffer, sizeof(buffer));
+        if (count == 0)
+            return contents;
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::generic_category(), "read");
+        }
+        contents.insert(contents.end(), buffer, buffer + count);
+    }
+}
+
+inline bool write_file(int fd, char const *data, std::size_t size)
+{
+    while (size != 0) {
+        auto const count = ::write(fd, data, size);
+        if (count == -1) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += count;
+        size -= count;
+    }
+    return true;
+}
+
+}   // namespace detail
+
+template<typename Event>
+class event_journal
+{
+    using format_t = detail::event_log_format<Event>;
+
+  public:
+    event_journal(event_journal &&)                 = delete;
+    event_journal &operator=(event_journal &&)      = delete;
+    event_journal(event_journal const &)            = delete;
+    event_journal &operator=(event_journal const &) = delete;
+
+    // open the journal for appending, creating it if it doesn't exist. a
+    // torn record at the end of the file, left by a crash part way through
+    // a commit, is truncated
+    explicit event_journal(std::string path, std::chrono::microseconds commit_interval = std::chrono::milliseconds(1))
+      : path_(std::move(path)),
+        commit_interval_(commit_interval)
+    {
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+        if (fd_ == -1)
+            throw std::system_error(errno, std::generic_category(), "open");
+
+        try {
+            auto const contents = detail::read_file(fd_);
+            if (contents.empty())
+                format_t::write_header(stream_);
+            else
+                scan(contents);
+
+            if (::ftruncate(fd_, static_cast<off_t>(durable_size_)) == -1
+            ||  ::lseek(fd_, 0, SEEK_END) == -1)
+            {
+                throw std::system_error(errno, std::generic_category(), "ftruncate");
+            }
+        }
+        catch (...) {
+            ::close(fd_);
+            throw;
+        }
+        appended_size_ = durable_size_ + pending_.bytes().size();
+        commit_thread_ = std::thread(std::bind(&event_journal::commit_thread, this));
+    }
+
+    ~event_journal()
+    {
+        {
+            std::scoped_lock lock(mutex_);
+            terminate_ = true;
+        }
+        work_available_.notify_one();
+        commit_thread_.join();
+        ::close(fd_);
+    }
+
+    // journal every event the state machine accepts. the journal must
+    // outlive the machine it is attached to
+    template<typename StateMachine>
+    void attach(StateMachine &fsm, std::uint64_t snapshot_every = 0)
+    {
+        using state_t    = typename StateMachine::state_type;
+        using time_point = typename StateMachine::clock_type::time_point;
+        static_assert(std::is_same_v<typename StateMachine::event_type, Event>);
+        fsm.add_accept_observer(
+            [this, &fsm, snapshot_every, last = std::optional<time_point>()](Event const &event, bool from_handler, state_t const *idle_state) mutable {
+                // an idle machine's state accounts for every record so far
+                if constexpr (std::is_trivially_copyable_v<state_t>) {
+                    if (snapshot_every != 0  &&  idle_state != nullptr)
+                        queue_snapshot(*idle_state, snapshot_every);
+                }
+
+                auto const now = fsm.clock().now();
+                auto const elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(now - last.value_or(now));
+                last = now;
+                append(event, from_handler? format_t::posted : format_t::accepted, elapsed);
+            });
+    }
+
+    // post an event to an attached machine and block until its record is
+    // durable. returns false, as set_event() does, if the machine didn't
+    // accept the event
+    template<typename StateMachine>
+    bool post(StateMachine &fsm, Event &&event)
+    {
+        if (!fsm.set_event(std::move(event)))
+            return false;
+        flush();
+        return true;
+    }
+
+    // buffer a record for the next commit, and return its sequence number.
+    // elapsed is the time on the machine's clock since the last record.
+    // throws the error of a failed commit
+    std::uint64_t append(Event const &event, std::size_t state_index, std::chrono::nanoseconds elapsed = {})
+    {
+        std::scoped_lock lock(mutex_);
+        if (error_ != 0)
+            throw std::system_error(error_, std::generic_category(), "journal commit");
+
+        auto const before = pending_.bytes().size();
+        format_t::write_record(stream_, event, state_index, elapsed);
+        appended_size_ += pending_.bytes().size() - before;
+        ++records_;
+        work_available_.notify_one();
+        return records_;
+    }
+
+    // block until every record appended so far is on disk
+    void flush()
+    {
+        std::unique_lock lock(mutex_);
+        auto const target = appended_size_;
+        flush_requested_ = true;
+        work_available_.notify_one();
+        committed_.wait(lock, [this, target] { return durable_size_ >= target  ||  error_ != 0; });
+        if (error_ != 0)
+            throw std::system_error(error_, std::generic_category(), "journal commit");
+    }
+
+    // write a snapshot of the state after every record appended so far.
+    // the machine must be idle, as idle_state() reports, so the state and
+    // the journal agree
+    template<typename State>
+    void write_snapshot(State const &state)
+    {
+        static_assert(std::is_trivially_copyable_v<State>, "snapshot states must be trivially copyable");
+
+        flush();
+
+        detail::snapshot_header header;
+        {
+            std::scoped_lock lock(mutex_);
+            header = make_snapshot_header(sizeof(State));
+        }
+        write_snapshot_file(header, reinterpret_cast<char const *>(&state));
+    }
+
+    static std::string snapshot_path(std::string const &path)
+    {
+        return path + ".snapshot";
+    }
+
+    // why the last snapshot attach() queued couldn't be written, which is
+    // cleared when one is. the next is queued snapshot_every records on
+    std::error_code snapshot_error() const
+    {
+        std::scoped_lock lock(mutex_);
+        return std::error_code(snapshot_error_, std::generic_category());
+    }
+
+    std::uint64_t records() const
+    {
+        std::scoped_lock lock(mutex_);
+        return records_;
+    }
+
+    // number of write()/fdatasync() batches committed
+    std::uint64_t commits() const
+    {
+        std::scoped_lock lock(mutex_);
+        return commits_;
+    }
+
+  private:
+    void scan(std::vector<char> const &contents)
+    {
+        char const *ptr = contents.data();
+        char const *end = contents.data() + contents.size();
+        if (!format_t::read_header(ptr, end))
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "journal has a different event layout");
+
+        // stop at the first incomplete record
+        for (char const *record=ptr; ptr != end; record=ptr) {
+            std::size_t              index;
+            std::size_t              state_index;
+            std::chrono::nanoseconds elapsed;
+            if (!format_t::read_record(ptr, end, index, state_index, elapsed)) {
+                ptr = record;
+                break;
+            }
+            ptr += format_t::payload_size_of(index);
+            ++records_;
+        }
+        durable_size_ = ptr - contents.data();
+        snapshot_records_ = records_;
+    }
+
+    // the mutex must be held
+    detail::snapshot_header make_snapshot_header(std::size_t state_size) const
+    {
+        detail::snapshot_header header;
+        std::memcpy(header.magic, detail::snapshot_header::magic_value, sizeof(header.magic));
+        header.version    = detail::snapshot_header::version_value;
+        header.state_size = state_size;
+        header.records    = records_;
+        header.log_offset = appended_size_;
+        return header;
+    }
+
+    // hand a snapshot to the commit thread if snapshot_every records have
+    // been appended since the last one. it is written once the records it
+    // includes are durable
+    template<typename State>
+    void queue_snapshot(State const &state, std::uint64_t snapshot_every)
+    {
+        std::scoped_lock lock(mutex_);
+        if (records_ - snapshot_records_ < snapshot_every)
+            return;
+
+        snapshot_header_ = make_snapshot_header(sizeof(State));
+        snapshot_state_.assign(reinterpret_cast<char const *>(&state), reinterpret_cast<char const *>(&state) + sizeof(State));
+        snapshot_pending_ = true;
+        snapshot_records_ = records_;
+        work_available_.notify_one();
+    }
+
+    void write_snapshot_file(detail::snapshot_header const &header, char const *state) const
+    {
+        // write to a temporary file and rename it over the old snapshot, so
+        // a crash leaves either the old snapshot or the new one
+        auto const temp = snapshot_path(path_) + ".tmp";
+        int const fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), "open");
+
+        bool const written = detail::write_file(fd, reinterpret_cast<char const *>(&header), sizeof(header))
+                         &&  detail::write_file(fd, state, header.state_size)
+                         &&  ::fdatasync(fd) == 0;
+        int const error = errno;
+        ::close(fd);
+        if (!written  ||  ::rename(temp.c_str(), snapshot_path(path_).c_str()) == -1)
+            throw std::system_error(written? errno : error, std::generic_category(), "snapshot");
+    }
+
+    void commit_thread()
+    {
+        std::vector<char> batch;
+        std::vector<char> snapshot;
+        std::unique_lock lock(mutex_);
+        for (;;) {
+            work_available_.wait(lock, [this] { return terminate_  ||  !pending_.bytes().empty()  ||  snapshot_pending_; });
+            if (pending_.bytes().empty()  &&  !snapshot_pending_)
+                return;
+
+            if (!pending_.bytes().empty()) {
+                // group commit. give other events the commit interval to
+                // join the batch, unless someone is waiting on it
+                if (!terminate_  &&  !flush_requested_)
+                    work_available_.wait_for(lock, commit_interval_, [this] { return terminate_  ||  flush_requested_; });
+
+                flush_requested_ = false;
+                std::swap(batch, pending_.bytes());
+                lock.unlock();
+
+                int error = 0;
+                if (!detail::write_file(fd_, batch.data(), batch.size())  ||  ::fdatasync(fd_) == -1)
+                    error = errno;
+
+                lock.lock();
+                if (error != 0) {
+                    error_ = error;
+                    committed_.notify_all();
+                    return;
+                }
+                durable_size_ += batch.size();
+                ++commits_;
+                batch.clear();
+                committed_.notify_all();
+            }
+
+            // every record the snapshot includes was appended before it was
+            // queued, so is durable by now
+            if (snapshot_pending_) {
+                auto const header = snapshot_header_;
+                std::swap(snapshot, snapshot_state_);
+                snapshot_pending_ = false;
+                lock.unlock();
+
+                int error = 0;
+                try {
+                    write_snapshot_file(header, snapshot.data());
+                }
+                catch (std::system_error const &e) {
+                    error = e.code().value();
+                }
+
+                lock.lock();
+                snapshot_error_ = error;
+            }
+        }
+    }
+
+  private:
+    std::string                     path_;
+    std::chrono::microseconds       commit_interval_;
+    int                             fd_ = -1;
+    bool                            terminate_        = false;
+    bool                            flush_requested_  = false;
+    int                             error_            = 0;     // of the commit that broke the journal
+    int                             snapshot_error_   = 0;
+    std::uint64_t                   records_          = 0;
+    std::uint64_t                   commits_          = 0;
+    std::uint64_t                   appended_size_    = 0;
+    std::uint64_t                   durable_size_     = 0;
+    std::uint64_t                   snapshot_records_ = 0;     // records when the last snapshot was queued
+    bool                            snapshot_pending_ = false;
+    detail::snapshot_header         snapshot_header_{};
+    std::vector<char>               snapshot_state_;
+    detail::byte_buffer_streambuf   pending_;
+    std::ostream                    stream_{&pending_};
+    std::mutex mutable              mutex_;
+    std::condition_variable         work_available_;
+    std::condition_variable         committed_;
+    std::thread                     commit_thread_;
+};
+
+// Restore a state machine from its journal, and the snapshot next to it if
+// there is a usable one, then take it out of replay mode. Events that were
+// deferred are deferred again, and events that were still queued are left
+// for the event thread to dispatch, so attach the journal first to record
+// what their handlers post. Replayed events aren't journalled again. Call
+// before any events are posted. A torn record at the end of the journal
+// stops the replay and clears result.valid_log
+template<typename StateMachine>
+replay_result recover(StateMachine &fsm, std::string const &path)
+{
+    using state_t  = typename StateMachine::state_type;
+    using format_t = detail::event_log_format<typename StateMachine::event_type>;
+
+    replay_result result;
+    int const fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        // nothing to recover
+        fsm.finish_replay();
+        result.valid_log = (errno == ENOENT);
+        return result;
+    }
+    std::vector<char> log;
+    try {
+        log = detail::read_file(fd);
+    }
+    catch (...) {
+        ::close(fd);
+        throw;
+    }
+    ::close(fd);
+
+    char const *ptr = log.data();
+    char const *end = log.data() + log.size();
+    if (!format_t::read_header(ptr, end)) {
+        fsm.finish_replay();
+        return result;
+    }
+    result.valid_log = true;
+
+    std::uint64_t records = 0;     // replayed from the snapshot
+    if constexpr (std::is_trivially_copyable_v<state_t>) {
+        int const snapshot_fd = ::open(event_journal<typename StateMachine::event_type>::snapshot_path(path).c_str(), O_RDONLY | O_CLOEXEC);
+        if (snapshot_fd != -1) {
+            detail::snapshot_header header;
+            alignas(state_t) unsigned char state[sizeof(state_t)];
+            bool const read = ::read(snapshot_fd, &header, sizeof(header)) == sizeof(header)
+                          &&  ::read(snapshot_fd, state, sizeof(state)) == sizeof(state);
+            ::close(snapshot_fd);
+
+            if (read
+            &&  std::memcmp(header.magic, detail::snapshot_header::magic_value, sizeof(header.magic)) == 0
+            &&  header.version    == detail::snapshot_header::version_value
+            &&  header.state_size == sizeof(state_t)
+            &&  header.log_offset >= std::size_t(ptr - log.data())
+            &&  header.log_offset <= log.size())
+            {
+                fsm.restore_state(*std::launder(reinterpret_cast<state_t *>(state)));
+                ptr       = log.data() + header.log_offset;
+                records   = header.records;
+            }
+        }
+    }
+
+    detail::replay_records(fsm, ptr, end, result, records);
+    fsm.finish_replay();
+    return result;
+}
+
+}   // namespace fsm
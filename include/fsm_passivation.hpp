@@ -0,0 +1,221 @@
+#pragma once
+
+#include "fsm.hpp"
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace fsm {
+
+// Fixed size records of a trivially copyable type, allocated in chunks and
+// addressed by slot number, with freed slots reused. Records are copied in
+// and out as raw bytes, so a passivated machine costs sizeof(T) bytes here.
+// Slot numbers are 32 bits to keep the free list small, so a store holds
+// at most 2^32 records, and store() throws std::length_error past that
+template<typename T>
+class state_store
+{
+    static_assert(std::is_trivially_copyable_v<T>, "stored states must be trivially copyable");
+
+  public:
+    using slot_type = std::uint32_t;
+
+    explicit state_store(std::size_t records_per_chunk = 4096)
+      : records_per_chunk_(records_per_chunk)
+    {
+    }
+
+    slot_type store(T const &value)
+    {
+        slot_type slot;
+        if (!free_.empty()) {
+            slot = free_.back();
+            free_.pop_back();
+        }
+        else {
+            if (size_ > std::numeric_limits<slot_type>::max())
+                throw std::length_error("state_store is full");
+            if (size_ == chunks_.size() * records_per_chunk_)
+                chunks_.push_back(std::make_unique<unsigned char[]>(records_per_chunk_ * sizeof(T)));
+            slot = static_cast<slot_type>(size_++);
+        }
+        std::memcpy(record(slot), &value, sizeof(T));
+        return slot;
+    }
+
+    T load(slot_type slot) const
+    {
+        T value;
+        std::memcpy(&value, record(slot), sizeof(T));
+        return value;
+    }
+
+    void release(slot_type slot)
+    {
+        free_.push_back(slot);
+    }
+
+    // records in use
+    std::size_t size() const noexcept
+    {
+        return size_ - free_.size();
+    }
+
+    std::size_t bytes_reserved() const noexcept
+    {
+        return chunks_.size() * records_per_chunk_ * sizeof(T) + free_.capacity() * sizeof(slot_type);
+    }
+
+  private:
+    unsigned char *record(slot_type slot) const noexcept
+    {
+        return chunks_[slot / records_per_chunk_].get() + (slot % records_per_chunk_) * sizeof(T);
+    }
+
+  private:
+    std::size_t                                    records_per_chunk_;
+    std::size_t                                    size_ = 0;
+    std::vector<std::unique_ptr<unsigned char[]>>  chunks_;
+    std::vector<slot_type>                         free_;
+};
+
+// Passivation
+//
+// A registry of keyed state machines where only the active ones exist as
+// objects. A machine that has been idle for the idle timeout, with no
+// events queued or deferred and no timers pending, is passivated: its
+// state is copied into a state_store and the machine, its queue and its
+// thread are destroyed. The next event posted to its key recreates the
+// machine from the factory, restores the state without calling enter(),
+// and delivers the event, so memory is proportional to the number of
+// active machines rather than the total
+//
+//     fsm::passivating_registry<crossing_state_machine, int> crossings(5min);
+//     crossings.post(42, events::press_button());
+//     ...
+//     crossings.passivate_idle();     // from a housekeeping timer
+//
+// States must be trivially copyable. Machines must only be posted to
+// through the registry, and anything a machine holds outside its state is
+// recreated by the factory rather than preserved
+template<typename StateMachine, typename Key, typename Hash = std::hash<Key>>
+class passivating_registry
+{
+    using event_t = typename StateMachine::event_type;
+    using state_t = typename StateMachine::state_type;
+    using store_t = state_store<state_t>;
+
+  public:
+    using factory_t = std::function<std::unique_ptr<StateMachine>(Key const &)>;
+
+    passivating_registry(passivating_registry &&)                 = delete;
+    passivating_registry &operator=(passivating_registry &&)      = delete;
+    passivating_registry(passivating_registry const &)            = delete;
+    passivating_registry &operator=(passivating_registry const &) = delete;
+
+    explicit passivating_registry(
+        std::chrono::steady_clock::duration idle_timeout,
+        factory_t factory = [](Key const &) { return std::make_unique<StateMachine>(); })
+      : idle_timeout_(idle_timeout),
+        factory_(std::move(factory))
+    {
+    }
+
+    // post an event to the machine for the key, creating or rehydrating it
+    // if necessary. returns the result of set_event()
+    bool post(Key const &key, event_t &&event)
+    {
+        std::scoped_lock lock(mutex_);
+        auto &entry = entries_[key];
+        if (!entry.machine) {
+            entry.machine = factory_(key);
+            if (entry.passivated) {
+                entry.machine->restore_state(store_.load(entry.slot));
+                store_.release(entry.slot);
+                entry.passivated = false;
+            }
+            ++active_;
+        }
+        entry.last_posted = std::chrono::steady_clock::now();
+        return entry.machine->set_event(std::move(event));
+    }
+
+    // passivate every machine that has been idle for the idle timeout, and
+    // return how many were passivated
+    std::size_t passivate_idle()
+    {
+        auto const cutoff = std::chrono::steady_clock::now() - idle_timeout_;
+
+        // destroying a machine joins its thread, so do it after releasing
+        // the lock
+        std::vector<std::unique_ptr<StateMachine>> passivated;
+        {
+            std::scoped_lock lock(mutex_);
+            for (auto &[key, entry] : entries_) {
+                if (!entry.machine  ||  entry.last_posted > cutoff)
+                    continue;
+
+                auto state = entry.machine->idle_state();
+                if (!state)
+                    continue;
+
+                entry.slot       = store_.store(*state);
+                entry.passivated = true;
+                passivated.push_back(std::move(entry.machine));
+                --active_;
+            }
+        }
+        return passivated.size();
+    }
+
+    // the state of the machine for the key, if it has been passivated or
+    // is active but idle
+    std::optional<state_t> state(Key const &key) const
+    {
+        std::scoped_lock lock(mutex_);
+        auto const it = entries_.find(key);
+        if (it == entries_.end())
+            return std::nullopt;
+        if (it->second.passivated)
+            return store_.load(it->second.slot);
+        return it->second.machine->idle_state();
+    }
+
+    std::size_t active() const
+    {
+        std::scoped_lock lock(mutex_);
+        return active_;
+    }
+
+    std::size_t passivated() const
+    {
+        std::scoped_lock lock(mutex_);
+        return store_.size();
+    }
+
+  private:
+    struct machine_entry
+    {
+        std::unique_ptr<StateMachine>          machine;
+        std::chrono::steady_clock::time_point  last_posted;
+        typename store_t::slot_type            slot       = 0;
+        bool                                   passivated = false;
+    };
+
+  private:
+    std::chrono::steady_clock::duration           idle_timeout_;
+    factory_t                                     factory_;
+    std::mutex mutable                            mutex_;
+    std::unordered_map<Key, machine_entry, Hash>  entries_;
+    store_t                                       store_;
+    std::size_t                                   active_ = 0;
+};
+
+}   // namespace fsm
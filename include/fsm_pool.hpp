@@ -0,0 +1,94 @@
+#pragma once
+
+#include "fsm.hpp"
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace fsm {
+
+// A pool of reusable state machines, for work that would otherwise create
+// a short-lived machine per request, such as a tokeniser per file.
+// Machines are reset and returned to the pool when their handle is
+// destroyed, keeping their event thread, so reuse costs a reset() rather
+// than a thread create and join
+//
+//     fsm::state_machine_pool<cpp_tokeniser_state_machine> tokenisers;
+//     auto tokeniser = tokenisers.acquire();
+//     tokeniser->tokenise(source);
+//
+// reset() only restores what the state machine owns. Members of the
+// derived machine, such as a tokeniser's errors, are reset by its
+// on_reset(). The pool must outlive the handles it gives out
+template<typename StateMachine>
+class state_machine_pool
+{
+  public:
+    class releaser
+    {
+      public:
+        explicit releaser(state_machine_pool *pool = nullptr) noexcept
+          : pool_(pool)
+        {
+        }
+
+        void operator()(StateMachine *fsm) const
+        {
+            pool_->release(fsm);
+        }
+
+      private:
+        state_machine_pool *pool_;
+    };
+
+    using handle = std::unique_ptr<StateMachine, releaser>;
+
+    state_machine_pool(state_machine_pool &&)                 = delete;
+    state_machine_pool &operator=(state_machine_pool &&)      = delete;
+    state_machine_pool(state_machine_pool const &)            = delete;
+    state_machine_pool &operator=(state_machine_pool const &) = delete;
+
+    explicit state_machine_pool(std::size_t initial_size = 0)
+    {
+        free_.reserve(initial_size);
+        for (std::size_t i=0; i<initial_size; ++i)
+            free_.push_back(std::make_unique<StateMachine>());
+    }
+
+    // a machine in its initial state, reused if there is one free
+    handle acquire()
+    {
+        {
+            std::scoped_lock lock(mutex_);
+            if (!free_.empty()) {
+                auto fsm = std::move(free_.back());
+                free_.pop_back();
+                return handle(fsm.release(), releaser(this));
+            }
+        }
+        return handle(new StateMachine, releaser(this));
+    }
+
+    // number of machines waiting to be reused
+    std::size_t available() const
+    {
+        std::scoped_lock lock(mutex_);
+        return free_.size();
+    }
+
+  private:
+    void release(StateMachine *fsm)
+    {
+        std::unique_ptr<StateMachine> owned(fsm);
+        owned->reset();
+
+        std::scoped_lock lock(mutex_);
+        free_.push_back(std::move(owned));
+    }
+
+  private:
+    std::mutex mutable                          mutex_;
+    std::vector<std::unique_ptr<StateMachine>>  free_;
+};
+
+}   // namespace fsm
@@ -0,0 +1,310 @@
+#pragma once
+
+#include "fsm.hpp"
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <new>
+#include <ostream>
+#include <istream>
+#include <vector>
+
+namespace fsm {
+
+// Binary event log
+//
+// The log starts with a header describing the event variant, so a replay
+// can reject a log recorded against different event types
+//     char[4]   magic "FSMR"
+//     uint16    format version
+//     uint16    number of event alternatives
+//     uint32    size of each event alternative
+//
+// followed by one record per delivered event, in the order they were
+// delivered
+//     uint8     event alternative index
+//     uint16    index of the state the event was delivered to
+//     int64     nanoseconds on the machine's clock since the last record
+//     byte[]    event payload, omitted for empty events
+//
+// The first record's time is from when the recorder was attached. Replay
+// advances a virtual_clock by each record's time before it delivers the
+// event, so a timed machine sees the times it saw when recorded. The times
+// are ignored by a machine on a real clock
+//
+// A journal records events as they are queued instead, with the state
+// index 0xffff, or 0xfffe for events posted by the machine's handlers.
+// Its replay queues the others, and dispatches them up to the point each
+// posted event was posted, so the replayed machine dispatches events in
+// the order the live one did
+//
+// Payloads are raw object bytes, so every event alternative must be
+// trivially copyable, and logs are only portable between builds with the
+// same event layout
+
+namespace detail {
+
+template<typename T>
+void write_raw(std::ostream &os, T value)
+{
+    os.write(reinterpret_cast<char const *>(&value), sizeof(T));
+}
+
+template<typename T>
+T read_raw(char const *&ptr)
+{
+    T value;
+    std::memcpy(&value, ptr, sizeof(T));
+    ptr += sizeof(T);
+    return value;
+}
+
+template<typename Event>
+struct event_log_format;
+
+template<typename... Events>
+struct event_log_format<std::variant<Events...>>
+{
+    static_assert((std::is_trivially_copyable_v<Events>  &&  ...),
+                  "recorded events must be trivially copyable");
+    static_assert(sizeof...(Events) <= 0xff);
+
+    static constexpr char          magic[4] = { 'F', 'S', 'M', 'R' };
+    static constexpr std::uint16_t version  = 3;
+
+    // the state index of records made when the event was queued
+    static constexpr std::size_t accepted = 0xffff;
+    static constexpr std::size_t posted   = 0xfffe;
+
+    template<typename E>
+    static constexpr std::size_t payload_size = std::is_empty_v<E>? 0 : sizeof(E);
+
+    static void write_header(std::ostream &os)
+    {
+        os.write(magic, sizeof(magic));
+        write_raw<std::uint16_t>(os, version);
+        write_raw<std::uint16_t>(os, sizeof...(Events));
+        (write_raw<std::uint32_t>(os, sizeof(Events)), ...);
+    }
+
+    static bool read_header(char const *&ptr, char const *end)
+    {
+        constexpr std::size_t header_size = sizeof(magic) + 2*sizeof(std::uint16_t) + sizeof...(Events)*sizeof(std::uint32_t);
+        if (std::size_t(end - ptr) < header_size  ||  std::memcmp(ptr, magic, sizeof(magic)) != 0)
+            return false;
+        ptr += sizeof(magic);
+
+        if (read_raw<std::uint16_t>(ptr) != version  ||  read_raw<std::uint16_t>(ptr) != sizeof...(Events))
+            return false;
+        return ((read_raw<std::uint32_t>(ptr) == sizeof(Events))  &&  ...);
+    }
+
+    static void write_record(std::ostream &os, std::variant<Events...> const &event, std::size_t state_index, std::chrono::nanoseconds elapsed)
+    {
+        assert(state_index <= accepted);
+
+        os.put(static_cast<char>(event.index()));
+        write_raw<std::uint16_t>(os, static_cast<std::uint16_t>(state_index));
+        write_raw<std::int64_t>(os, elapsed.count());
+        std::visit(
+            [&os](auto const &e) {
+                using E = std::decay_t<decltype(e)>;
+                if constexpr (payload_size<E> != 0)
+                    os.write(reinterpret_cast<char const *>(&e), sizeof(E));
+            },
+            event);
+    }
+
+    // read a record up to its payload, leaving ptr at the payload. returns
+    // false if the record is malformed or truncated
+    static bool read_record(char const *&ptr, char const *end, std::size_t &index, std::size_t &state_index, std::chrono::nanoseconds &elapsed)
+    {
+        constexpr std::size_t record_header_size = sizeof(std::uint8_t) + sizeof(std::uint16_t) + sizeof(std::int64_t);
+        if (std::size_t(end - ptr) < record_header_size)
+            return false;
+
+        index       = read_raw<std::uint8_t>(ptr);
+        state_index = read_raw<std::uint16_t>(ptr);
+        elapsed     = std::chrono::nanoseconds(read_raw<std::int64_t>(ptr));
+        return index < sizeof...(Events)
+           &&  std::size_t(end - ptr) >= payload_size_of(index);
+    }
+
+    template<std::size_t I>
+    static std::variant<Events...> read_event(char const *&ptr)
+    {
+        using E = std::variant_alternative_t<I, std::variant<Events...>>;
+        if constexpr (std::is_empty_v<E>  &&  std::is_default_constructible_v<E>)
+            return std::variant<Events...>(std::in_place_index<I>);
+        else {
+            // the bytes were copied from a live object of a trivially
+            // copyable type, so copying them back recreates that object
+            alignas(E) unsigned char storage[sizeof(E)];
+            std::memcpy(storage, ptr, payload_size<E>);
+            ptr += payload_size<E>;
+            return std::variant<Events...>(std::in_place_index<I>, std::move(*std::launder(reinterpret_cast<E *>(storage))));
+        }
+    }
+
+    static std::variant<Events...> read_event(std::size_t index, char const *&ptr)
+    {
+        return read_event(index, ptr, std::index_sequence_for<Events...>());
+    }
+
+    template<std::size_t... Is>
+    static std::variant<Events...> read_event(std::size_t index, char const *&ptr, std::index_sequence<Is...>)
+    {
+        using reader_t = std::variant<Events...> (*)(char const *&);
+        static constexpr reader_t readers[] = { &read_event<Is>... };
+        return readers[index](ptr);
+    }
+
+    static std::size_t payload_size_of(std::size_t index)
+    {
+        static constexpr std::size_t sizes[] = { payload_size<Events>... };
+        return sizes[index];
+    }
+};
+
+}   // namespace detail
+
+// Records every event delivered to a state machine. The recorder must
+// outlive the machine it is attached to, and the stream must outlive the
+// recorder
+template<typename Event>
+class event_recorder
+{
+  public:
+    event_recorder(event_recorder &&)                 = delete;
+    event_recorder &operator=(event_recorder &&)      = delete;
+    event_recorder(event_recorder const &)            = delete;
+    event_recorder &operator=(event_recorder const &) = delete;
+
+    explicit event_recorder(std::ostream &os)
+      : os_(os)
+    {
+        detail::event_log_format<Event>::write_header(os_);
+    }
+
+    template<typename StateMachine>
+    void attach(StateMachine &fsm)
+    {
+        static_assert(std::is_same_v<typename StateMachine::event_type, Event>);
+        fsm.add_dispatch_observer(
+            [this, &fsm, last = fsm.clock().now()](Event const &event, std::size_t state_index) mutable {
+                auto const now = fsm.clock().now();
+                record(event, state_index, std::chrono::duration_cast<std::chrono::nanoseconds>(now - last));
+                last = now;
+            });
+    }
+
+    // elapsed is the time on the machine's clock since the last record
+    void record(Event const &event, std::size_t state_index, std::chrono::nanoseconds elapsed = {})
+    {
+        detail::event_log_format<Event>::write_record(os_, event, state_index, elapsed);
+        ++events_;
+    }
+
+    std::uint64_t events() const noexcept
+    {
+        return events_;
+    }
+
+  private:
+    std::ostream  &os_;
+    std::uint64_t  events_ = 0;
+};
+
+struct replay_result
+{
+    bool                     valid_log       = false;
+    std::uint64_t            events          = 0;
+    std::uint64_t            mismatches      = 0;   // events delivered to a different state than recorded, or posted out of turn
+    std::uint64_t            first_mismatch  = 0;   // the number of the first record that diverged, from 1
+    std::chrono::nanoseconds elapsed{};
+
+    bool ok() const noexcept
+    {
+        return valid_log  &&  mismatches == 0;
+    }
+
+    double events_per_second() const noexcept
+    {
+        return elapsed.count() == 0? 0.0 : events * 1e9 / elapsed.count();
+    }
+};
+
+namespace detail {
+
+// deliver the records between ptr and end to the state machine. records
+// is the number of records before ptr
+template<typename StateMachine>
+void replay_records(StateMachine &fsm, char const *ptr, char const *end, replay_result &result, std::uint64_t records = 0)
+{
+    using format_t = event_log_format<typename StateMachine::event_type>;
+    using clock_t  = typename StateMachine::clock_type;
+
+    auto const start = std::chrono::steady_clock::now();
+    while (ptr != end) {
+        std::size_t              index;
+        std::size_t              state_index;
+        std::chrono::nanoseconds elapsed;
+        if (!format_t::read_record(ptr, end, index, state_index, elapsed)) {
+            result.valid_log = false;
+            break;
+        }
+        ++records;
+
+        if constexpr (clock_t::is_virtual) {
+            auto &clock = fsm.clock();
+            clock.advance_to(clock.now() + std::chrono::duration_cast<typename clock_t::duration>(elapsed));
+        }
+
+        bool matched = true;
+        if (state_index == format_t::accepted)
+            fsm.replay_accepted_event(format_t::read_event(index, ptr));
+        else if (state_index == format_t::posted) {
+            // the replayed handler posts the event again
+            ptr += format_t::payload_size_of(index);
+            matched = fsm.replay_posted_event(index);
+        }
+        else
+            matched = fsm.replay_event(format_t::read_event(index, ptr)) == state_index;
+
+        if (!matched) {
+            if (result.mismatches++ == 0)
+                result.first_mismatch = records;
+        }
+        ++result.events;
+    }
+    result.elapsed = std::chrono::steady_clock::now() - start;
+}
+
+}   // namespace detail
+
+// Feed a recorded log into a fresh state machine as fast as possible on
+// the calling thread, checking that each event is delivered to the same
+// state as it was when recorded. A virtual_clock is moved on to the time
+// each event was delivered first
+template<typename StateMachine>
+replay_result replay(StateMachine &fsm, std::istream &is)
+{
+    using format_t = detail::event_log_format<typename StateMachine::event_type>;
+
+    // load the whole log up front so the timing covers decoding and
+    // dispatch, not I/O
+    std::vector<char> const log{std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>()};
+
+    replay_result result;
+    char const *ptr = log.data();
+    char const *end = log.data() + log.size();
+    if (!format_t::read_header(ptr, end))
+        return result;
+    result.valid_log = true;
+
+    detail::replay_records(fsm, ptr, end, result);
+    return result;
+}
+
+}   // namespace fsm
@@ -0,0 +1,426 @@
+#pragma once
+
+#if defined(_WIN32)
+#error "fsm_shm_queue.hpp requires POSIX shared memory"
+#endif
+
+#include "fsm.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fsm {
+
+// Cross-process event queue
+//
+// A bounded lock-free ring in a POSIX shared memory segment. The owning
+// process creates the segment and moves events from it on to its state
+// machine; other processes on the same host open it by name and post
+// events directly into the ring, with no system calls and no copies
+// beyond the event itself
+//
+//     // owner
+//     auto queue = fsm::shm_event_queue<events_t>::create("/crossing", 4096);
+//     fsm::shm_event_pump pump(crossing, queue);
+//
+//     // producer, in another process
+//     auto queue = fsm::shm_event_queue<events_t>::open("/crossing");
+//     queue.push(events::press_button{});
+//
+// The ring feeds the machine's own event queue rather than replacing it,
+// so each event is copied once more, under the queue's mutex, before it is
+// dispatched. shm_event_pump does that on a thread of its own, which adds
+// a hop between threads and, once the ring has been idle for a while, up
+// to its idle sleep to the latency of the next event. A machine driven by
+// an external loop can call poll() instead, to move and dispatch events
+// on the loop's thread.
+//
+// Events are copied as raw bytes between processes, so they must be
+// trivially copyable, and every process must be built with the same
+// event layout
+//
+// A producer that dies between claiming a slot and publishing it wedges
+// the ring for good: the consumer can't get past the unpublished slot, so
+// once the ring fills every push() times out. Nothing in the ring can tell
+// a dead producer from a slow one, so the owner has to create a new
+// segment. push() also times out if the consumer stops taking events
+
+namespace detail {
+
+// bounded multi-producer ring after Dmitry Vyukov's MPMC queue. each cell
+// carries a sequence number that says whether it is ready to be written
+// or read for the current lap of the ring, so producers only contend on
+// the enqueue position and never on the consumer
+template<typename Event>
+struct shm_cell
+{
+    std::atomic<std::uint64_t> sequence;
+    alignas(Event) unsigned char storage[sizeof(Event)];
+};
+
+struct shm_header
+{
+    static constexpr char          magic_value[4] = { 'F', 'S', 'M', 'Q' };
+    static constexpr std::uint32_t version_value  = 1;
+
+    char                              magic[4];
+    std::uint32_t                     version;
+    std::uint32_t                     event_size;
+    std::uint32_t                     event_align;
+    std::uint64_t                     capacity;
+    std::atomic<std::uint32_t>        ready;
+
+    alignas(64) std::atomic<std::uint64_t> enqueue_pos;
+    alignas(64) std::atomic<std::uint64_t> dequeue_pos;
+};
+
+}   // namespace detail
+
+template<typename Event>
+class shm_event_queue
+{
+    static_assert(std::is_trivially_copyable_v<Event>, "shared memory events must be trivially copyable");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "shared memory queue needs address-free atomics");
+
+    using cell_t = detail::shm_cell<Event>;
+
+  public:
+    shm_event_queue(shm_event_queue const &)            = delete;
+    shm_event_queue &operator=(shm_event_queue const &) = delete;
+
+    shm_event_queue(shm_event_queue &&other) noexcept
+      : name_(std::move(other.name_)),
+        header_(std::exchange(other.header_, nullptr)),
+        cells_(std::exchange(other.cells_, nullptr)),
+        mapped_size_(std::exchange(other.mapped_size_, 0)),
+        owner_(std::exchange(other.owner_, false))
+    {
+    }
+
+    shm_event_queue &operator=(shm_event_queue &&other) noexcept
+    {
+        if (this != &other) {
+            release();
+            name_        = std::move(other.name_);
+            header_      = std::exchange(other.header_, nullptr);
+            cells_       = std::exchange(other.cells_, nullptr);
+            mapped_size_ = std::exchange(other.mapped_size_, 0);
+            owner_       = std::exchange(other.owner_, false);
+        }
+        return *this;
+    }
+
+    ~shm_event_queue()
+    {
+        release();
+    }
+
+    // create a new segment. capacity is rounded up to a power of two. the
+    // segment is unlinked when the creating queue is destroyed. throws
+    // std::errc::file_exists if a segment of that name exists, whether it
+    // belongs to a running process or was left by one that didn't shut
+    // down cleanly; see remove()
+    static shm_event_queue create(std::string name, std::size_t capacity)
+    {
+        std::size_t rounded = 2;
+        while (rounded < capacity)
+            rounded <<= 1;
+
+        int const fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd == -1)
+            throw_errno("shm_open");
+
+        std::size_t const size = segment_size(rounded);
+        if (::ftruncate(fd, static_cast<off_t>(size)) == -1) {
+            int const error = errno;
+            ::close(fd);
+            ::shm_unlink(name.c_str());
+            throw std::system_error(error, std::generic_category(), "ftruncate");
+        }
+
+        shm_event_queue queue(std::move(name), fd, size, true);
+
+        auto header = new (queue.header_) detail::shm_header;
+        std::memcpy(header->magic, detail::shm_header::magic_value, sizeof(header->magic));
+        header->version     = detail::shm_header::version_value;
+        header->event_size  = sizeof(Event);
+        header->event_align = alignof(Event);
+        header->capacity    = rounded;
+        header->enqueue_pos.store(0, std::memory_order_relaxed);
+        header->dequeue_pos.store(0, std::memory_order_relaxed);
+        for (std::size_t i=0; i<rounded; ++i)
+            new (&queue.cells_[i].sequence) std::atomic<std::uint64_t>(i);
+
+        // producers that open the segment early spin until it is initialised
+        header->ready.store(1, std::memory_order_release);
+        return queue;
+    }
+
+    // remove a stale segment, once the caller knows its owner is gone.
+    // processes that still have it open keep their mapping
+    static void remove(std::string const &name)
+    {
+        if (::shm_unlink(name.c_str()) == -1  &&  errno != ENOENT)
+            throw_errno("shm_unlink");
+    }
+
+    // open a segment created by another process, waiting up to timeout for
+    // its creator to size and initialise it. throws std::errc::timed_out if
+    // it doesn't, as when the creator died part way through create()
+    static shm_event_queue open(std::string name, std::chrono::milliseconds timeout = std::chrono::seconds(1))
+    {
+        int const fd = ::shm_open(name.c_str(), O_RDWR, 0);
+        if (fd == -1)
+            throw_errno("shm_open");
+
+        // the segment is empty until its creator has sized it
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        struct stat st;
+        for (;;) {
+            if (::fstat(fd, &st) == -1) {
+                int const error = errno;
+                ::close(fd);
+                throw std::system_error(error, std::generic_category(), "fstat");
+            }
+            if (static_cast<std::size_t>(st.st_size) >= segment_size(0))
+                break;
+            if (std::chrono::steady_clock::now() >= deadline) {
+                ::close(fd);
+                throw std::system_error(std::make_error_code(std::errc::timed_out), "shared memory segment was never initialised");
+            }
+            std::this_thread::yield();
+        }
+
+        auto const size = static_cast<std::size_t>(st.st_size);
+        shm_event_queue queue(std::move(name), fd, size, false);
+        auto const header = queue.header_;
+        while (header->ready.load(std::memory_order_acquire) == 0) {
+            if (std::chrono::steady_clock::now() >= deadline)
+                throw std::system_error(std::make_error_code(std::errc::timed_out), "shared memory segment was never initialised");
+            std::this_thread::yield();
+        }
+
+        if (std::memcmp(header->magic, detail::shm_header::magic_value, sizeof(header->magic)) != 0
+        ||  header->version     != detail::shm_header::version_value
+        ||  header->event_size  != sizeof(Event)
+        ||  header->event_align != alignof(Event)
+        ||  segment_size(header->capacity) > size)
+        {
+            throw std::system_error(std::make_error_code(std::errc::invalid_argument), "shared memory segment has a different event layout");
+        }
+        return queue;
+    }
+
+    std::size_t capacity() const noexcept
+    {
+        return static_cast<std::size_t>(header_->capacity);
+    }
+
+    // returns false if the ring is full
+    bool try_push(Event const &event) noexcept
+    {
+        auto const mask = header_->capacity - 1;
+        auto pos = header_->enqueue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell_t &cell = cells_[pos & mask];
+            auto const seq = cell.sequence.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::int64_t>(seq - pos);
+            if (diff == 0) {
+                if (header_->enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::memcpy(cell.storage, &event, sizeof(Event));
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = header_->enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // spin until there is room in the ring. throws std::errc::timed_out if
+    // there is none within timeout, as when the consumer has gone or the
+    // ring is wedged
+    void push(Event const &event, std::chrono::milliseconds timeout = std::chrono::seconds(1))
+    {
+        if (try_push(event))
+            return;
+
+        auto const deadline = std::chrono::steady_clock::now() + timeout;
+        for (unsigned tries=1; !try_push(event); ++tries) {
+            // reading the clock costs more than a yield, so only check the
+            // deadline now and again
+            if (tries % 64 == 0  &&  std::chrono::steady_clock::now() >= deadline)
+                throw std::system_error(std::make_error_code(std::errc::timed_out), "shared memory queue is full");
+            std::this_thread::yield();
+        }
+    }
+
+    // returns false if the ring is empty. safe to call from several
+    // consumers, though a queue normally feeds a single state machine
+    bool try_pop(Event &event) noexcept
+    {
+        auto const mask = header_->capacity - 1;
+        auto pos = header_->dequeue_pos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell_t &cell = cells_[pos & mask];
+            auto const seq = cell.sequence.load(std::memory_order_acquire);
+            auto const diff = static_cast<std::int64_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (header_->dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    std::memcpy(&event, cell.storage, sizeof(Event));
+                    cell.sequence.store(pos + header_->capacity, std::memory_order_release);
+                    return true;
+                }
+            }
+            else if (diff < 0)
+                return false;
+            else
+                pos = header_->dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+
+    // for a state machine driven by an external loop. move up to
+    // max_events events from the ring on to the machine, and dispatch
+    // whatever it has queued, on the calling thread. returns the number
+    // of events taken from the ring
+    template<typename StateMachine>
+    std::size_t poll(StateMachine &fsm, std::size_t max_events = 64)
+    {
+        Event       event;
+        std::size_t moved = 0;
+        while (moved < max_events  &&  try_pop(event)) {
+            fsm.set_event(std::move(event));
+            ++moved;
+        }
+        fsm.poll_once();
+        return moved;
+    }
+
+  private:
+    shm_event_queue(std::string name, int fd, std::size_t size, bool owner)
+      : name_(std::move(name)),
+        mapped_size_(size),
+        owner_(owner)
+    {
+        void *addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        int const error = errno;
+        ::close(fd);
+        if (addr == MAP_FAILED) {
+            if (owner_)
+                ::shm_unlink(name_.c_str());
+            throw std::system_error(error, std::generic_category(), "mmap");
+        }
+
+        header_ = static_cast<detail::shm_header *>(addr);
+        cells_  = reinterpret_cast<cell_t *>(static_cast<unsigned char *>(addr) + cells_offset);
+    }
+
+    static constexpr std::size_t cells_offset = (sizeof(detail::shm_header) + alignof(cell_t) - 1) / alignof(cell_t) * alignof(cell_t);
+
+    static std::size_t segment_size(std::size_t capacity) noexcept
+    {
+        return cells_offset + capacity * sizeof(cell_t);
+    }
+
+    [[noreturn]] static void throw_errno(char const *what)
+    {
+        throw std::system_error(errno, std::generic_category(), what);
+    }
+
+    void release() noexcept
+    {
+        if (header_)
+            ::munmap(header_, mapped_size_);
+        if (owner_)
+            ::shm_unlink(name_.c_str());
+        header_ = nullptr;
+        owner_  = false;
+    }
+
+  private:
+    std::string          name_;
+    detail::shm_header  *header_      = nullptr;
+    cell_t              *cells_       = nullptr;
+    std::size_t          mapped_size_ = 0;
+    bool                 owner_       = false;
+};
+
+// Moves events from a shared memory queue on to a state machine's event
+// queue on a dedicated thread. The thread spins briefly when the ring is
+// empty, then backs off to yielding and sleeping for idle_sleep, so an
+// idle queue costs little CPU while a busy one is drained without system
+// calls. A shorter idle sleep trades CPU for the latency of the first
+// event after a lull
+template<typename StateMachine>
+class shm_event_pump
+{
+    using event_t = typename StateMachine::event_type;
+
+  public:
+    shm_event_pump(shm_event_pump &&)                 = delete;
+    shm_event_pump &operator=(shm_event_pump &&)      = delete;
+    shm_event_pump(shm_event_pump const &)            = delete;
+    shm_event_pump &operator=(shm_event_pump const &) = delete;
+
+    shm_event_pump(StateMachine &fsm, shm_event_queue<event_t> &queue, std::chrono::microseconds idle_sleep = std::chrono::microseconds(50))
+      : fsm_(fsm),
+        queue_(queue),
+        idle_sleep_(idle_sleep),
+        thread_([this] { pump(); })
+    {
+    }
+
+    ~shm_event_pump()
+    {
+        stop_.store(true, std::memory_order_relaxed);
+        thread_.join();
+    }
+
+    std::uint64_t events() const noexcept
+    {
+        return events_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    void pump()
+    {
+        event_t event;
+        unsigned idle = 0;
+        while (!stop_.load(std::memory_order_relaxed)) {
+            if (queue_.try_pop(event)) {
+                fsm_.set_event(std::move(event));
+                events_.store(events_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                idle = 0;
+            }
+            else if (++idle < 64)
+                continue;
+            else if (idle < 128)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(idle_sleep_);
+        }
+    }
+
+  private:
+    StateMachine                &fsm_;
+    shm_event_queue<event_t>    &queue_;
+    std::chrono::microseconds    idle_sleep_;
+    std::atomic<bool>            stop_{false};
+    std::atomic<std::uint64_t>   events_{0};
+    std::thread                  thread_;
+};
+
+}   // namespace fsm
@@ -0,0 +1,394 @@
+#pragma once
+
+#include "fsm_core.hpp"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace fsm {
+
+// A fixed size ring of events stored inline. push_front() is used to
+// re-inject deferred events ahead of everything else queued
+template<typename Event, std::size_t Capacity>
+class inline_event_queue
+{
+    static_assert(Capacity > 0, "the event queue needs room for at least one event");
+
+  public:
+    bool empty() const noexcept
+    {
+        return size_ == 0;
+    }
+
+    bool full() const noexcept
+    {
+        return size_ == Capacity;
+    }
+
+    std::size_t size() const noexcept
+    {
+        return size_;
+    }
+
+    static constexpr std::size_t capacity() noexcept
+    {
+        return Capacity;
+    }
+
+    Event &front() noexcept
+    {
+        return events_[head_];
+    }
+
+    Event &operator[](std::size_t n) noexcept
+    {
+        return events_[wrap(head_ + n)];
+    }
+
+    bool push_back(Event &&event) noexcept(std::is_nothrow_move_assignable_v<Event>)
+    {
+        if (full())
+            return false;
+        events_[wrap(head_ + size_)] = std::move(event);
+        ++size_;
+        return true;
+    }
+
+    bool push_front(Event &&event) noexcept(std::is_nothrow_move_assignable_v<Event>)
+    {
+        if (full())
+            return false;
+        head_ = wrap(head_ + Capacity - 1);
+        events_[head_] = std::move(event);
+        ++size_;
+        return true;
+    }
+
+    void pop_front() noexcept
+    {
+        head_ = wrap(head_ + 1);
+        --size_;
+    }
+
+    // remove the nth event, keeping the order of the others
+    void erase(std::size_t n) noexcept(std::is_nothrow_move_assignable_v<Event>)
+    {
+        for (; n+1<size_; ++n)
+            (*this)[n] = std::move((*this)[n+1]);
+        --size_;
+    }
+
+    void clear() noexcept
+    {
+        head_ = 0;
+        size_ = 0;
+    }
+
+  private:
+    static constexpr std::size_t wrap(std::size_t n) noexcept
+    {
+        return n % Capacity;
+    }
+
+  private:
+    std::array<Event, Capacity> events_{};
+    std::size_t                 head_ = 0;
+    std::size_t                 size_ = 0;
+};
+
+// Freestanding state machine
+//
+// The same handlers, transition descriptors, enter(), leave(), reenter()
+// and deferral as state_machine, for real-time code that can't have a heap
+// allocation, a lock or a system call in its dispatch path. There is no
+// event thread, no I/O and no timers: events are held in a fixed size
+// queue inside the object, and the owner dispatches them by calling step()
+// or run() from its own loop
+//
+//     class controller : public fsm::static_state_machine<controller, states::type, events::type, 32>
+//     ...
+//     controller fsm;
+//     fsm.set_event(events::sample{reading});    // false if the queue is full
+//     fsm.run();                                  // dispatch everything queued
+//
+// Only this header and fsm_core.hpp are needed, and neither includes
+// <iostream>, <thread>, <deque> or <functional>. The machine isn't thread
+// safe; events posted from another thread or an interrupt handler need to
+// go through a queue the owner drains, such as an SPSC ring. Deferred
+// events are held in a second queue of the same capacity, and an event
+// that doesn't fit in it is dropped and counted. Recalled events that
+// don't fit in a full event queue are kept deferred until there is room
+template<typename Derived, typename State, typename Event, std::size_t QueueCapacity>
+class static_state_machine
+{
+  private:
+    using event_t = Event;
+    using state_t = State;
+    using derived_t = Derived;
+    using queue_t = inline_event_queue<event_t, QueueCapacity>;
+
+    static_assert(std::is_default_constructible_v<event_t>, "events are stored inline, so the first event type must be default constructible");
+
+    template<typename S>
+    struct has_deferred_events;
+
+    template<typename... States>
+    struct has_deferred_events<std::variant<States...>>
+      : std::bool_constant<(requires { typename States::deferred_events; }  ||  ...)>
+    {
+    };
+
+    static constexpr bool has_deferring_states = has_deferred_events<state_t>::value;
+
+    struct no_deferred_events
+    {
+        void clear() noexcept
+        {
+        }
+    };
+
+    // machines without deferring states don't pay for the second queue
+    using deferred_queue_t = std::conditional_t<has_deferring_states, queue_t, no_deferred_events>;
+
+  public:
+    using event_type = Event;
+    using state_type = State;
+
+    // make the state machine non-copyable, non-movable
+    static_state_machine(static_state_machine &&)                 = delete;
+    static_state_machine &operator=(static_state_machine &&)      = delete;
+    static_state_machine(static_state_machine const &)            = delete;
+    static_state_machine &operator=(static_state_machine const &) = delete;
+
+    static_state_machine() = default;
+
+    // queue an event, returning false if the queue is full
+    bool set_event(event_t &&event)
+    {
+        return event_queue_.push_back(std::move(event));
+    }
+
+    // dispatch the event at the front of the queue. returns false if there
+    // was none
+    bool step()
+    {
+        if constexpr (has_deferring_states) {
+            if (recall_pending_)
+                recall_deferred_events();
+        }
+
+        if (event_queue_.empty())
+            return false;
+
+        event_t event = std::move(event_queue_.front());
+        event_queue_.pop_front();
+        process_event(std::move(event));
+        return true;
+    }
+
+    // dispatch queued events, including any the handlers post, until the
+    // queue is empty or max_events have been dispatched. returns the number
+    // dispatched
+    std::size_t run(std::size_t max_events = std::size_t(-1))
+    {
+        std::size_t dispatched = 0;
+        while (dispatched < max_events  &&  step())
+            ++dispatched;
+        return dispatched;
+    }
+
+    std::size_t queued_events() const noexcept
+    {
+        return event_queue_.size();
+    }
+
+    static constexpr std::size_t queue_capacity() noexcept
+    {
+        return QueueCapacity;
+    }
+
+    // deferred events that were dropped because the deferred queue was full
+    std::uint64_t dropped_deferred_events() const noexcept
+    {
+        return dropped_deferred_;
+    }
+
+    std::size_t current_state_index() const noexcept
+    {
+        return current_state_.index();
+    }
+
+    template<typename S>
+    bool is_in() const noexcept
+    {
+        static_assert(detail::variant_index<S, state_t>::value != std::variant_npos, "S is not a state of this machine");
+        return current_state_.index() == detail::variant_index<S, state_t>::value;
+    }
+
+    state_t const &state() const noexcept
+    {
+        return current_state_;
+    }
+
+    // discard queued and deferred events and return to the initial state
+    // without calling leave() or enter()
+    void reset()
+    {
+        event_queue_.clear();
+        deferred_events_.clear();
+        dropped_deferred_ = 0;
+        recall_pending_   = false;
+        current_state_ = state_t();
+    }
+
+  protected:
+    void process_event(event_t &&event)
+    {
+        if constexpr (has_deferring_states) {
+            if (is_deferred(event)) {
+                if (!deferred_events_.push_back(std::move(event)))
+                    ++dropped_deferred_;
+                return;
+            }
+        }
+
+        std::visit(
+            [this](auto &state, auto &event) { dispatch(state, std::move(event)); },
+            current_state_, event);
+    }
+
+    // the fallback for state/event pairs without a handler
+    unhandled on_event(auto &&, auto &&)
+    {
+        return {};
+    }
+
+  private:
+    bool is_deferred(event_t const &event) const
+    {
+        return std::visit(
+            [](auto const &state, auto const &event) {
+                return defers_event<std::decay_t<decltype(state)>, std::decay_t<decltype(event)>>();
+            },
+            current_state_, event);
+    }
+
+    void recall_deferred_events()
+    {
+        // only the earliest events there is room for in the queue are
+        // recalled. the rest stay deferred, and step() recalls them as the
+        // queue drains
+        auto const  room     = QueueCapacity - event_queue_.size();
+        auto        end      = deferred_events_.size();
+        std::size_t recalled = 0;
+        for (std::size_t n=0; n<deferred_events_.size(); ++n) {
+            if (!is_deferred(deferred_events_[n])  &&  recalled++ == room) {
+                end = n;
+                break;
+            }
+        }
+        recall_pending_ = end != deferred_events_.size();
+
+        // re-inject events that the new state doesn't defer ahead of
+        // everything else queued, as they arrived first. walk backwards so
+        // that pushing each to the front preserves their order
+        for (std::size_t n=end; n-- > 0; ) {
+            if (!is_deferred(deferred_events_[n])) {
+                event_queue_.push_front(std::move(deferred_events_[n]));
+                deferred_events_.erase(n);
+            }
+        }
+    }
+
+    template<typename S, typename E>
+    void dispatch(S &state, E &&event)
+    {
+        auto instance = static_cast<derived_t *>(this);
+
+        // prefer an in-place handler, which avoids moving the state in and
+        // out of the handler for every event
+        if constexpr (requires { instance->react(state, std::move(event)); })
+            apply_transition(state, instance->react(state, std::move(event)));
+        else
+            apply_transition(state, instance->on_event(std::move(state), std::move(event)));
+    }
+
+    template<typename S>
+    void apply_transition(S &state, unhandled)
+    {
+        reenter(state);
+    }
+
+    template<typename S>
+    void apply_transition(S &state, stay)
+    {
+        reenter(state);
+    }
+
+    template<typename S, typename T, typename... Args>
+    void apply_transition(S &state, go_to<T, Args...> &&next)
+    {
+        if constexpr (!std::is_same_v<S, T>)
+            leave(state);
+        std::apply(
+            [this](auto &&...args) { current_state_.template emplace<T>(std::move(args)...); },
+            std::move(next.args));
+        if constexpr (std::is_same_v<S, T>)
+            reenter(std::get<T>(current_state_));
+        else
+            enter(std::get<T>(current_state_));
+    }
+
+    template<typename S>
+    void apply_transition(S &state, state_t &&new_state)
+    {
+        bool const state_changed = (new_state.index() != current_state_.index());
+        if (state_changed)
+            leave(state);
+        current_state_ = std::move(new_state);
+        std::visit(
+            [this, state_changed](auto &state) {
+                if (state_changed)
+                    enter(state);
+                else
+                    reenter(state);
+            },
+            current_state_);
+    }
+
+    void enter(auto &state)
+    {
+        auto instance = static_cast<derived_t *>(this);
+        if constexpr (requires { state.enter(*instance); })
+            state.enter(*instance);
+
+        if constexpr (has_deferring_states) {
+            if (!deferred_events_.empty())
+                recall_deferred_events();
+        }
+    }
+
+    void leave(auto &state)
+    {
+        auto instance = static_cast<derived_t *>(this);
+        if constexpr (requires { state.leave(*instance); })
+            state.leave(*instance);
+    }
+
+    void reenter(auto &state)
+    {
+        auto instance = static_cast<derived_t *>(this);
+        if constexpr (requires { state.reenter(*instance); })
+            state.reenter(*instance);
+    }
+
+  private:
+    state_t                         current_state_;
+    queue_t                         event_queue_;
+    [[no_unique_address]]
+    deferred_queue_t                deferred_events_;
+    std::uint64_t                   dropped_deferred_ = 0;
+    bool                            recall_pending_   = false;  // deferred events wait for room in the queue
+};
+
+}   // namespace fsm
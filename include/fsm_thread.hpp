@@ -0,0 +1,89 @@
+#pragma once
+
+#include "fsm.hpp"
+#include <string>
+#include <string_view>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace fsm {
+
+// Event thread placement
+//
+// Pin a state machine's event thread to a CPU, typically an isolated core
+// in busy poll mode, and give it a name that shows up in debuggers,
+// profilers and top
+//
+//     crossing.set_busy_poll();
+//     fsm::pin_event_thread(crossing, 3);
+//     fsm::name_event_thread(crossing, "crossing");
+//
+// Both return false if the platform doesn't support the request, and for
+// a machine driven by an external loop, which has no event thread. Linux
+// limits thread names to 15 characters, so longer names aren't set there
+
+inline bool set_thread_affinity(std::thread::native_handle_type thread, unsigned cpu)
+{
+#if defined(_WIN32)
+    if (cpu >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return ::SetThreadAffinityMask(thread, DWORD_PTR(1) << cpu) != 0;
+#elif defined(__linux__)
+    if (cpu >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    return ::pthread_setaffinity_np(thread, sizeof(cpus), &cpus) == 0;
+#else
+    (void)thread;
+    (void)cpu;
+    return false;
+#endif
+}
+
+inline bool set_thread_name(std::thread::native_handle_type thread, std::string_view name)
+{
+#if defined(_WIN32)
+    std::wstring const wide(name.begin(), name.end());
+    return SUCCEEDED(::SetThreadDescription(thread, wide.c_str()));
+#elif defined(__linux__)
+    // rather than truncate a name to the 15 characters Linux allows
+    if (name.size() > 15)
+        return false;
+    return ::pthread_setname_np(thread, std::string(name).c_str()) == 0;
+#else
+    (void)thread;
+    (void)name;
+    return false;
+#endif
+}
+
+template<typename StateMachine>
+bool pin_event_thread(StateMachine &fsm, unsigned cpu)
+{
+    if (fsm.external_loop())
+        return false;
+    return set_thread_affinity(fsm.event_thread_handle(), cpu);
+}
+
+template<typename StateMachine>
+bool name_event_thread(StateMachine &fsm, std::string_view name)
+{
+    if (fsm.external_loop())
+        return false;
+    return set_thread_name(fsm.event_thread_handle(), name);
+}
+
+}   // namespace fsm
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+
+#if defined(__AVX2__)  ||  defined(__SSSE3__)
+#include <immintrin.h>
+#endif
+
+namespace tokeniser {
+
+// Character classes, packed one bit per class into a single 256 byte table
+// indexed by the unsigned value of the character
+namespace char_class {
+
+enum : std::uint8_t {
+    token_char    = 1 << 0,
+    numeric_digit = 1 << 1,
+    space         = 1 << 2,
+    operator_char = 1 << 3,
+    quote         = 1 << 4,
+    bin_digit     = 1 << 5,
+    oct_digit     = 1 << 6,
+    hex_digit     = 1 << 7,
+};
+
+}   // namespace char_class
+
+using char_class_table = std::array<std::uint8_t, 256>;
+
+// add the class to each of the characters
+constexpr char_class_table add_char_class(char_class_table table, std::string_view chars, std::uint8_t cls)
+{
+    for (auto ch : chars)
+        table[static_cast<unsigned char>(ch)] |= cls;
+    return table;
+}
+
+// remove the class from each of the characters
+constexpr char_class_table remove_char_class(char_class_table table, std::string_view chars, std::uint8_t cls)
+{
+    for (auto ch : chars)
+        table[static_cast<unsigned char>(ch)] &= ~cls;
+    return table;
+}
+
+constexpr char_class_table make_default_char_classes()
+{
+    char_class_table table{};
+    table = add_char_class(table, "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz_", char_class::token_char);
+    table = add_char_class(table, "0123456789",             char_class::numeric_digit);
+    table = add_char_class(table, " \t\r\n\f\v",            char_class::space);
+    table = add_char_class(table, "*|&!<>=+-/,.^()[]{}:;",  char_class::operator_char);
+    table = add_char_class(table, "'\"",                    char_class::quote);
+    table = add_char_class(table, "01",                     char_class::bin_digit);
+    table = add_char_class(table, "01234567",               char_class::oct_digit);
+    table = add_char_class(table, "0123456789ABCDEFabcdef", char_class::hex_digit);
+    return table;
+}
+
+inline constexpr char_class_table default_char_classes = make_default_char_classes();
+
+// A set of byte values, for skipping a run of characters of a class 16 or
+// 32 at a time. Membership is a 256 bit bitmap held as two 16 byte rows
+// indexed by the low nibble, one for bytes below 0x80 and one for the
+// rest, with a bit per value of the high nibble, so a block of bytes is
+// classified with three byte shuffles whatever the set. the same bitmap
+// is kept in the usual order for single characters
+class byte_set
+{
+  public:
+    // the characters whose classes match the predicate
+    template<typename Predicate>
+    static constexpr byte_set from(char_class_table const &classes, Predicate predicate)
+    {
+        byte_set set;
+        for (unsigned ch=0; ch<256; ++ch) {
+            if (predicate(static_cast<char>(ch), classes[ch])) {
+                auto &row = ch < 0x80? set.low_ : set.high_;
+                row[ch & 0x0f]   |= static_cast<std::uint8_t>(1 << ((ch >> 4) & 7));
+                set.bits_[ch >> 3] |= static_cast<std::uint8_t>(1 << (ch & 7));
+            }
+        }
+        return set;
+    }
+
+    constexpr bool contains(char ch) const noexcept
+    {
+        auto const byte = static_cast<unsigned char>(ch);
+        return (bits_[byte >> 3] & (1 << (byte & 7))) != 0;
+    }
+
+    // the first character in [begin, end) that isn't in the set, or end
+    char const *skip(char const *begin, char const *end) const noexcept
+    {
+        // most runs in source code are short, so try a few characters one
+        // at a time before going wide
+        auto next = begin;
+        for (auto const short_run=next + std::min<std::ptrdiff_t>(end - next, 8); next != short_run; ++next) {
+            if (!contains(*next))
+                return next;
+        }
+#if defined(__AVX2__)
+        auto const low  = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const *>(low_.data())));
+        auto const high = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<__m128i const *>(high_.data())));
+        auto const bits = _mm256_setr_epi8(
+            1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+            1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        auto const low_nibble = _mm256_set1_epi8(static_cast<char>(0x8f));
+        auto const top_bit    = _mm256_set1_epi8(-128);
+        auto const nibble     = _mm256_set1_epi8(0x0f);
+
+        for (; end - next >= 32; next += 32) {
+            auto const chars = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(next));
+            // a shuffle index with its top bit set gives zero, which picks
+            // the row for each half of the byte values
+            auto const index = _mm256_and_si256(chars, low_nibble);
+            auto const row   = _mm256_or_si256(
+                _mm256_shuffle_epi8(low, index),
+                _mm256_shuffle_epi8(high, _mm256_xor_si256(index, top_bit)));
+            auto const bit   = _mm256_shuffle_epi8(bits, _mm256_and_si256(_mm256_srli_epi16(chars, 4), nibble));
+            auto const in    = _mm256_cmpeq_epi8(_mm256_and_si256(row, bit), bit);
+            auto const out   = ~static_cast<std::uint32_t>(_mm256_movemask_epi8(in));
+            if (out != 0)
+                return next + std::countr_zero(out);
+        }
+#elif defined(__SSSE3__)
+        auto const low  = _mm_loadu_si128(reinterpret_cast<__m128i const *>(low_.data()));
+        auto const high = _mm_loadu_si128(reinterpret_cast<__m128i const *>(high_.data()));
+        auto const bits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+        auto const low_nibble = _mm_set1_epi8(static_cast<char>(0x8f));
+        auto const top_bit    = _mm_set1_epi8(-128);
+        auto const nibble     = _mm_set1_epi8(0x0f);
+
+        for (; end - next >= 16; next += 16) {
+            auto const chars = _mm_loadu_si128(reinterpret_cast<__m128i const *>(next));
+            auto const index = _mm_and_si128(chars, low_nibble);
+            auto const row   = _mm_or_si128(
+                _mm_shuffle_epi8(low, index),
+                _mm_shuffle_epi8(high, _mm_xor_si128(index, top_bit)));
+            auto const bit   = _mm_shuffle_epi8(bits, _mm_and_si128(_mm_srli_epi16(chars, 4), nibble));
+            auto const in    = _mm_cmpeq_epi8(_mm_and_si128(row, bit), bit);
+            auto const out   = ~static_cast<std::uint32_t>(_mm_movemask_epi8(in)) & 0xffff;
+            if (out != 0)
+                return next + std::countr_zero(out);
+        }
+#endif
+        while (next != end  &&  contains(*next))
+            ++next;
+        return next;
+    }
+
+  private:
+    std::array<std::uint8_t, 16> low_{};    // the shuffle tables
+    std::array<std::uint8_t, 16> high_{};
+    std::array<std::uint8_t, 32> bits_{};   // a plain bitmap, for one character at a time
+};
+
+}   // namespace tokeniser
@@ -0,0 +1,564 @@
+#pragma once
+
+#include "tokeniser.hpp"
+#include <algorithm>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace tokeniser {
+
+// Direct coded tokeniser
+//
+// The states of tokeniser::states compiled into one synchronous scanning
+// loop, for throughput. Each token state becomes a loop over the source
+// that runs for as long as the state would have posted continue_token
+// to itself, and each transition is a jump to the next loop, so there is
+// no event queue, no event thread and no state or event object per
+// character, and runs of whitespace, token characters and digits are
+// skipped 16 or 32 bytes at a time with byte_set. The character classes
+// and the match_operator(), greedy_operator_check() and is_keyword()
+// customisation points are taken from a state machine of type
+// StateMachine, so the rules of a derived tokeniser such as
+// cpp_tokeniser_state_machine apply unchanged
+//
+//     tokeniser::direct_tokeniser<cpp_tokeniser::cpp_tokeniser_state_machine> tokeniser;
+//     tokeniser.tokenise(source);
+//
+// Tokens and errors are reported exactly as the event driven tokeniser
+// reports them, to the trace output or a token sink
+//
+// An expression too large to hold in memory can be streamed through the
+// tokeniser a chunk at a time with feed() and finish(). Tokens that lie
+// within a chunk are delivered straight from it, and only a token that
+// may run on past the end of a chunk, such as a half read hex literal or
+// an open string, is copied, so the memory used is bounded by the longest
+// token rather than the size of the input. it isn't constant: a string
+// literal that spans many chunks is held in full until it ends. the scan
+// of a carried token picks up where the last chunk left it, so each byte
+// is scanned once however many chunks the token spans
+//
+//     for (auto chunk : chunks)
+//         tokeniser.feed(chunk, sink);
+//     tokeniser.finish(sink);
+template<typename StateMachine>
+class direct_tokeniser
+{
+  public:
+    void tokenise(std::string_view expr)
+    {
+#if TRACE_TOKENISER  ||  TRACE_TOKENS
+        std::cout << "\n\033[92mParsing: \"" << expr << "\"\033[0m\n";
+#endif  // TRACE_TOKENISER
+
+        auto trace = [this, expr](token const &tok) {
+            detail::write_token_info(machine_, expr, tok);
+        };
+        stream_position position;
+        scanner<decltype(trace)> scan(machine_, expr, trace, position, true);
+        scan.run();
+
+        errors_.clear();
+        if (auto const &error = position.error) {
+            errors_.push_back(*error);
+            detail::write_error(expr, *error);
+        }
+    }
+
+    // tokenise, delivering each token to sink(tokeniser::token const &)
+    // instead of the trace output. the sink is called inline from the
+    // scanning loop, and errors are only recorded
+    template<typename Sink>
+        requires std::invocable<Sink &, token const &>
+    void tokenise(std::string_view expr, Sink &&sink)
+    {
+        stream_position position;
+        scanner<std::remove_reference_t<Sink>> scan(machine_, expr, sink, position, true);
+        scan.run();
+
+        errors_.clear();
+        if (position.error)
+            errors_.push_back(*position.error);
+    }
+
+    // tokenise the next chunk of a streamed expression. the text of a
+    // token is only valid for the duration of the call to the sink, as
+    // it may point into a buffer that is reused for the next chunk. after
+    // an error the rest of the expression is ignored, as it is by
+    // tokenise()
+    template<typename Sink>
+        requires std::invocable<Sink &, token const &>
+    void feed(std::string_view chunk, Sink &&sink)
+    {
+        if (stream_.error)
+            return;
+        if (stream_.offset == 0  &&  carry_.empty())
+            errors_.clear();    // the start of the expression
+
+        if (!carry_.empty())
+            chunk = complete_carried_token(chunk, sink);
+        if (!stream_.error  &&  !chunk.empty()) {
+            scanner<std::remove_reference_t<Sink>> scan(machine_, chunk, sink, stream_, false);
+            carry_.assign(scan.run());
+            carry_progress_ = scan.progress();
+        }
+
+        if (stream_.error)
+            errors_.push_back(*stream_.error);
+    }
+
+    // end the streamed expression, delivering the last token, and start
+    // a new one
+    template<typename Sink>
+        requires std::invocable<Sink &, token const &>
+    void finish(Sink &&sink)
+    {
+        if (!stream_.error  &&  !carry_.empty()) {
+            scanner<std::remove_reference_t<Sink>> scan(machine_, carry_, sink, stream_, true);
+            scan.run();
+            if (stream_.error)
+                errors_.push_back(*stream_.error);
+        }
+        carry_.clear();
+        carry_progress_ = {};
+        stream_ = {};
+    }
+
+    // the errors found in the last expression tokenised or streamed.
+    // tokenise() without a sink also writes them to the trace output
+    std::span<tokenise_error const> errors() const noexcept
+    {
+        return errors_;
+    }
+
+    // where the tokenising of an expression has got to. offsets are from
+    // the start of the expression
+    struct stream_position
+    {
+        int64_t                         offset = 0;     // of the text being scanned
+        std::optional<tokenise_error>   error;          // that ended the expression
+    };
+
+    // tokenise part of an expression, starting at position, which is
+    // moved on past the text scanned. returns the text left over, from the
+    // start of a token that may continue past the end of the part, which
+    // is nothing if the part is the last. the tokeniser isn't changed, so
+    // parts may be tokenised concurrently
+    template<typename Sink>
+        requires std::invocable<Sink &, token const &>
+    std::string_view tokenise_part(std::string_view text, Sink &&sink, stream_position &position, bool last) const
+    {
+        scanner<std::remove_reference_t<Sink>> scan(machine_, text, sink, position, last);
+        return scan.run();
+    }
+
+    // the state machine that supplies the character classes
+    StateMachine &machine() noexcept
+    {
+        return machine_;
+    }
+
+  private:
+    // how much of a chunk is copied at a time to complete a token carried
+    // over from the previous one
+    static constexpr std::size_t carry_step = 64;
+
+    // where the scan of a token that ran out at the end of the text had
+    // got to, so it can carry on when more of the token arrives
+    enum class token_phase { start, ended, operator_token, string_literal, symbol, numeric, numeric_base, dec_literal, exponent, digits };
+    struct token_progress
+    {
+        token_phase     phase   = token_phase::start;   // start scans the token again
+        token_type      type    = token_type::unknown;
+        std::size_t     token   = 0;    // the offset of its text, after the base of a literal
+        std::size_t     scanned = 0;    // the number of characters scanned
+    };
+
+    // completes the token carried over from the previous chunk, copying
+    // as little of this chunk as it takes, and returns the rest of the
+    // chunk. the scan carries on from carry_progress_, so only the
+    // characters copied from this chunk are scanned
+    template<typename Sink>
+    std::string_view complete_carried_token(std::string_view chunk, Sink &sink)
+    {
+        auto copied = std::size_t(0);   // carry_ ends this far into the chunk
+        auto want   = std::min(chunk.size(), carry_step);
+        for (;;) {
+            carry_.append(chunk.substr(copied, want - copied));
+            copied = want;
+
+            scanner<std::remove_reference_t<Sink>> scan(machine_, carry_, sink, stream_, false);
+            auto const complete = scan.resume_token(carry_progress_);
+            if (stream_.error) {
+                carry_.clear();
+                return {};
+            }
+            if (complete) {
+                auto const unscanned = carry_.size() - scan.scanned();
+                if (unscanned <= copied) {
+                    carry_.clear();
+                    return chunk.substr(copied - unscanned);
+                }
+
+                // the token ended within the carried text, as an operator
+                // does when the longer one it might have been isn't there,
+                // and the next token starts where it ended
+                carry_.erase(0, scan.scanned());
+                carry_progress_ = {};
+                continue;
+            }
+
+            // the token runs on, and starts after any blanks scanned
+            carry_.erase(0, scan.scanned());
+            carry_progress_ = scan.progress();
+            if (copied == chunk.size())
+                return {};  // the token runs on past this chunk too
+            want = std::min(chunk.size(), want * 2);
+        }
+    }
+
+    template<typename Sink>
+    class scanner
+    {
+      public:
+        // text is the whole expression if last is true, or the next part
+        // of a streamed expression at position
+        scanner(StateMachine const &fsm, std::string_view text, Sink &sink, stream_position &position, bool last) noexcept
+          : fsm_(fsm),
+            sink_(sink),
+            position_(position),
+            origin_(position.offset),
+            begin_(text.data()),
+            next_(text.data()),
+            end_(text.data() + text.size()),
+            last_(last)
+        {
+        }
+
+        // scans the text, and returns the part of it that is left over,
+        // from the start of a token that may continue in the next part of
+        // the expression. nothing is left over from the last part
+        std::string_view run()
+        {
+            while (run_token())
+                ;
+            if (position_.error)
+                return {};
+            return std::string_view(next_, end_ - next_);
+        }
+
+        // scans the next token. returns false at the end of the text,
+        // after an error, or at a token that may continue in the next
+        // part of the expression, which is left unscanned
+        bool run_token()
+        {
+            if (!next_token()) {
+                advance();
+                return false;
+            }
+            return end_token();
+        }
+
+        // as run_token(), carrying on with a token at the start of the
+        // text from where the scan of the part before got to
+        bool resume_token(token_progress const &progress)
+        {
+            if (progress.phase == token_phase::start)
+                return run_token();
+
+            token_start_ = begin_;
+            token_       = begin_ + progress.token;
+            next_        = begin_ + progress.scanned;
+            type_        = progress.type;
+            switch (progress.phase) {
+                case token_phase::start:          break;
+                case token_phase::ended:          break;
+                case token_phase::operator_token: operator_token();       break;
+                case token_phase::string_literal: string_literal_token(); break;
+                case token_phase::symbol:         symbol_token();         break;
+                case token_phase::numeric:        numeric_token();        break;
+                case token_phase::numeric_base:   numeric_base_token();   break;
+                case token_phase::dec_literal:    dec_literal();          break;
+                case token_phase::exponent:       exponent();             break;
+                case token_phase::digits:         digits(type_);          break;
+            }
+            return end_token();
+        }
+
+        // the number of characters scanned
+        std::size_t scanned() const noexcept
+        {
+            return next_ - begin_;
+        }
+
+        // how far the scan of the token left over by run() got
+        token_progress const &progress() const noexcept
+        {
+            return progress_;
+        }
+
+      private:
+        // states::new_token. skips whitespace, then scans a token. returns
+        // false at the end of the expression
+        bool next_token()
+        {
+            next_ = blanks.skip(next_, end_);
+            if (next_ == end_)
+                return false;
+
+            token_start_ = token_ = next_;
+            phase_ = token_phase::start;
+            auto const ch = *next_++;
+            if (ch == '.') {
+                if (!has_more_chars()  &&  !last_)
+                    ;   // a decimal literal or an operator, scanned when the next part comes
+                else if (has_more_chars()  &&  fsm_.is_numeric_digit(*next_))
+                    dec_literal();
+                else
+                    operator_token();
+            }
+            else if (ch == '0')
+                numeric_base_token();
+            else if (fsm_.is_numeric_digit(ch))
+                numeric_token();
+            else if (fsm_.is_operator_char(ch))
+                operator_token();
+            else if (fsm_.is_quote_char(ch))
+                string_literal_token();
+            else
+                symbol_token();
+            return true;
+        }
+
+        // ends the token scanned, which is left unscanned if it may continue
+        // in the next part of the expression
+        bool end_token()
+        {
+            if (position_.error)
+                return false;
+
+            if (!has_more_chars()  &&  !last_) {
+                progress_ = { phase_, type_, std::size_t(token_ - token_start_), std::size_t(next_ - token_start_) };
+                next_ = token_start_;
+                advance();
+                return false;
+            }
+
+            auto const complete = complete_token();
+            advance();
+            return complete;
+        }
+
+        // states::token_complete. returns false if tokenising ends with an
+        // error
+        bool complete_token()
+        {
+            if (has_more_chars()
+            &&  type_ != token_type::operator_token
+            &&  !fsm_.is_token_separator(*next_))
+            {
+                error(error_type::invalid_separator);
+                return false;
+            }
+
+            if (next_ != token_)
+                sink_(detail::make_token(fsm_, type_, std::string_view(token_, next_ - token_), offset_of(token_)));
+            return true;
+        }
+
+        void operator_token()
+        {
+            phase_ = token_phase::operator_token;
+            type_  = token_type::operator_token;
+            if constexpr (requires { fsm_.match_operator(std::string_view()); }) {
+                auto const match = fsm_.match_operator(std::string_view(token_, end_ - token_));
+                if (match.at_end  &&  !last_)
+                    next_ = end_;   // a longer operator may be completed by the next part
+                else
+                    next_ = token_ + std::max<std::size_t>(match.length, 1);
+            }
+            else if constexpr (requires { fsm_.greedy_operator_check(std::string_view()); }) {
+                while (has_more_chars()  &&  fsm_.greedy_operator_check(std::string_view(token_, next_ - token_ + 1)))
+                    ++next_;
+            }
+        }
+
+        void string_literal_token()
+        {
+            phase_ = token_phase::string_literal;
+            type_  = token_type::string_literal;
+            next_ = std::find(next_, end_, *token_);
+            if (has_more_chars()) {
+                ++next_;    // the closing quote
+                phase_ = token_phase::ended;
+            }
+        }
+
+        // states::in_symbol_token, and states::in_keyword_token, which it
+        // moves to if the complete token is a keyword
+        void symbol_token()
+        {
+            phase_ = token_phase::symbol;
+            type_  = token_type::symbol;
+            next_ = token_chars.skip(next_, end_);
+            if constexpr (requires { fsm_.is_keyword(std::string_view()); }) {
+                if (fsm_.is_keyword(std::string_view(token_, next_ - token_)))
+                    type_ = token_type::keyword;
+            }
+        }
+
+        void numeric_token()
+        {
+            phase_ = token_phase::numeric;
+            type_  = token_type::numeric_literal;
+            next_ = numeric_digits.skip(next_, end_);
+            if (!has_more_chars())
+                return;
+
+            auto const ch = *next_;
+            if (ch == '.') {
+                ++next_;
+                dec_literal();
+            }
+            else if (ch == 'e'  ||  ch == 'E') {
+                ++next_;
+                exponent();
+            }
+        }
+
+        // the token is a leading zero
+        void numeric_base_token()
+        {
+            phase_ = token_phase::numeric_base;
+            type_  = token_type::numeric_literal;
+            if (!has_more_chars())
+                return;
+
+            switch (*next_) {
+                case 'b':
+                    // clear the leading 0 and skip the base indicator
+                    token_ = ++next_;
+                    digits(token_type::bin_literal);
+                    return;
+
+                case 'x':
+                    token_ = ++next_;
+                    digits(token_type::hex_literal);
+                    return;
+
+                case 'e':
+                case 'E':
+                    ++next_;
+                    exponent();
+                    return;
+
+                case '.':
+                    ++next_;
+                    dec_literal();
+                    return;
+
+                default:
+                    if (fsm_.is_oct_digit(*next_))
+                        digits(token_type::oct_literal);
+            }
+        }
+
+        void dec_literal()
+        {
+            phase_ = token_phase::dec_literal;
+            type_  = token_type::dec_literal;
+            next_ = numeric_digits.skip(next_, end_);
+            if (!has_more_chars())
+                return;
+
+            auto const ch = *next_;
+            if (ch == 'e'  ||  ch == 'E') {
+                ++next_;
+                exponent();
+            }
+            else if (ch == '.')
+                error(error_type::extra_decimal_point);
+        }
+
+        void exponent()
+        {
+            phase_ = token_phase::exponent;
+            type_  = token_type::dec_literal;
+            // allow a sign for the exponent
+            if (has_more_chars()  &&  next_[-1] == 'e'  &&  (*next_ == '-'  ||  *next_ == '+'))
+                ++next_;
+            next_ = numeric_digits.skip(next_, end_);
+        }
+
+        // the digits of a binary, octal or hex literal
+        void digits(token_type type)
+        {
+            phase_ = token_phase::digits;
+            type_  = type;
+            auto const &digit_chars = type == token_type::bin_literal ? bin_digits
+                                    : type == token_type::hex_literal ? hex_digits
+                                    : oct_digits;
+            next_ = digit_chars.skip(next_, end_);
+        }
+
+        // records the error at the next character, and skips it
+        void error(error_type type)
+        {
+            auto const offset = offset_of(next_);
+            position_.error = tokenise_error{ type, *next_++, static_cast<std::uint64_t>(offset) };
+        }
+
+        // the offset of a character from the start of the expression
+        int64_t offset_of(char const *ch) const noexcept
+        {
+            return origin_ + (ch - begin_);
+        }
+
+        // moves the position on to the next character to be scanned
+        void advance() noexcept
+        {
+            position_.offset = offset_of(next_);
+        }
+
+        bool has_more_chars() const noexcept
+        {
+            return next_ != end_;
+        }
+
+      private:
+        // runs of these are skipped in bulk. they come from the character
+        // class table rather than the is_*() functions, so a derived
+        // tokeniser customises them through its char_classes
+        static constexpr auto &classes = StateMachine::char_classes;
+        static constexpr auto blanks         = byte_set::from(classes, [](char, auto cls) { return (cls & char_class::space) != 0; });
+        static constexpr auto token_chars    = byte_set::from(classes, [](char, auto cls) { return (cls & char_class::token_char) != 0; });
+        static constexpr auto numeric_digits = byte_set::from(classes, [](char, auto cls) { return (cls & char_class::numeric_digit) != 0; });
+        static constexpr auto bin_digits     = byte_set::from(classes, [](char, auto cls) { return (cls & char_class::bin_digit) != 0; });
+        static constexpr auto oct_digits     = byte_set::from(classes, [](char, auto cls) { return (cls & char_class::oct_digit) != 0; });
+        static constexpr auto hex_digits     = byte_set::from(classes, [](char, auto cls) { return (cls & char_class::hex_digit) != 0; });
+
+        StateMachine const &fsm_;
+        Sink               &sink_;
+        stream_position    &position_;
+        int64_t const       origin_;        // the offset of the text
+        char const         *begin_;
+        char const         *next_;
+        char const         *end_;
+        char const         *token_       = nullptr;
+        char const         *token_start_ = nullptr;  // before the base of a literal is skipped
+        token_type          type_        = token_type::unknown;
+        token_phase         phase_       = token_phase::start;
+        token_progress      progress_;                  // of the token left over
+        bool const          last_;
+    };
+
+  private:
+    StateMachine                    machine_;
+    stream_position                 stream_;
+    std::string                     carry_;     // the start of a token that runs on into the next chunk
+    token_progress                  carry_progress_;
+    std::vector<tokenise_error>     errors_;
+};
+
+}   // namespace tokeniser
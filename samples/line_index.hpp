@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#if defined(__AVX2__)  ||  defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+namespace tokeniser {
+
+// a line and column in some text, both from 1
+struct text_location
+{
+    std::size_t line;
+    std::size_t column;
+};
+
+// Maps offsets in some text, such as those of tokens and errors, to lines
+// and columns. The newlines are found with a vectorised scan of the text
+// the first time a location is asked for, so a text that is never asked
+// about costs nothing, and each lookup is then a binary search of them.
+// The text isn't copied, so must outlive the index, and the first lookup
+// builds the index, so it mustn't be made from several threads at once
+class line_index
+{
+  public:
+    line_index() = default;
+
+    explicit line_index(std::string_view text) noexcept
+      : text_(text)
+    {
+    }
+
+    // the index of another text, reusing the memory of this one
+    void reset(std::string_view text) noexcept
+    {
+        text_    = text;
+        indexed_ = false;
+        newlines_.clear();
+    }
+
+    // the location of the character at offset, or of the end of the text
+    text_location locate(std::uint64_t offset) const
+    {
+        if (!indexed_)
+            index();
+
+        // a newline is on the line it ends
+        auto const newline    = std::lower_bound(newlines_.begin(), newlines_.end(), offset);
+        auto const line       = newline - newlines_.begin();
+        auto const line_start = line == 0? 0 : newline[-1] + 1;
+        return { static_cast<std::size_t>(line + 1), static_cast<std::size_t>(offset - line_start + 1) };
+    }
+
+    std::size_t lines() const
+    {
+        if (!indexed_)
+            index();
+        return newlines_.size() + 1;
+    }
+
+  private:
+    void index() const
+    {
+        auto const begin = text_.data();
+        auto const end   = begin + text_.size();
+        auto       next  = begin;
+#if defined(__AVX2__)
+        auto const newline = _mm256_set1_epi8('\n');
+        for (; end - next >= 32; next += 32) {
+            auto const chars = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(next));
+            for (auto found=static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, newline))); found != 0; found &= found - 1)
+                newlines_.push_back(next - begin + std::countr_zero(found));
+        }
+#elif defined(__SSE2__)
+        auto const newline = _mm_set1_epi8('\n');
+        for (; end - next >= 16; next += 16) {
+            auto const chars = _mm_loadu_si128(reinterpret_cast<__m128i const *>(next));
+            for (auto found=static_cast<std::uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chars, newline))); found != 0; found &= found - 1)
+                newlines_.push_back(next - begin + std::countr_zero(found));
+        }
+#endif
+        for (; next != end; ++next) {
+            if (*next == '\n')
+                newlines_.push_back(next - begin);
+        }
+        indexed_ = true;
+    }
+
+  private:
+    std::string_view                     text_;
+    mutable std::vector<std::uint64_t>   newlines_;     // the offset of each newline in the text
+    mutable bool                         indexed_ = false;
+};
+
+}   // namespace tokeniser
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string_view>
+
+namespace tokeniser {
+
+// the result of matching an operator at the start of some text
+struct operator_match
+{
+    std::size_t length = 0;         // of the longest operator, 0 if none
+    bool        at_end = false;     // the text ended before a longer operator was ruled out
+};
+
+// the number of nodes in a trie of the operators, including the root
+template<typename Operators>
+consteval std::size_t operator_trie_nodes(Operators const &operators)
+{
+    std::size_t nodes = 1;
+    for (auto op=operators.begin(); op!=operators.end(); ++op) {
+        for (std::size_t length=1; length<=op->first.size(); ++length) {
+            auto const prefix = op->first.substr(0, length);
+            bool seen = false;
+            for (auto other=operators.begin(); other!=op  &&  !seen; ++other)
+                seen = other->first.substr(0, length) == prefix;
+            if (!seen)
+                ++nodes;
+        }
+    }
+    return nodes;
+}
+
+// A set of operators compiled into a trie at compile time, which matches
+// the longest operator at the start of some text in one pass, a table
+// lookup per character, whether or not the shorter prefixes of it are
+// operators themselves, such as .. of ... or ->* when -> isn't one
+//
+//     static constexpr auto operator_trie = tokeniser::operator_trie<tokeniser::operator_trie_nodes(operators)>(operators);
+//
+// Operators is a range of entries whose first member is the operator,
+// such as a perfect_hash_map
+template<std::size_t Nodes>
+class operator_trie
+{
+    static_assert(Nodes < 256, "nodes are indexed by a byte");
+
+  public:
+    template<typename Operators>
+    consteval explicit operator_trie(Operators const &operators)
+    {
+        std::size_t nodes = 1;
+        for (auto const &op : operators) {
+            std::size_t node = 0;
+            for (auto ch : op.first) {
+                auto &column = columns_[static_cast<unsigned char>(ch)];
+                if (column == 0) {
+                    if (++column_count_ == max_columns)
+                        throw "too many operator characters";
+                    column = column_count_;
+                }
+
+                auto &next = next_[node][column];
+                if (next == 0)
+                    next = static_cast<std::uint8_t>(nodes++);
+                node = next;
+            }
+            accepts_[node] = true;
+        }
+    }
+
+    constexpr operator_match match(std::string_view text) const noexcept
+    {
+        operator_match result;
+        std::size_t    node = 0;
+        for (std::size_t length=0; length<text.size(); ) {
+            // a character in no operator has column 0, which leads nowhere
+            node = next_[node][columns_[static_cast<unsigned char>(text[length])]];
+            if (node == 0)
+                return result;
+            ++length;
+            if (accepts_[node])
+                result.length = length;
+        }
+        result.at_end = true;
+        return result;
+    }
+
+  private:
+    static constexpr std::size_t max_columns = 32;
+
+    std::array<std::uint8_t, 256>                                columns_{};    // of each character in the table
+    std::array<std::array<std::uint8_t, max_columns>, Nodes>     next_{};       // node 0 is the root, so never next
+    std::array<bool, Nodes>                                      accepts_{};
+    std::uint8_t                                                 column_count_ = 0;
+};
+
+}   // namespace tokeniser
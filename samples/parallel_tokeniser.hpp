@@ -0,0 +1,284 @@
+#pragma once
+
+#if defined(_WIN32)
+#error "parallel_tokeniser.hpp requires POSIX memory mapped files"
+#endif
+
+#include "direct_tokeniser.hpp"
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace tokeniser {
+
+// a file mapped read only into memory
+class mapped_file
+{
+  public:
+    explicit mapped_file(char const *path)
+    {
+        int const fd = ::open(path, O_RDONLY);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), "open");
+
+        struct stat status;
+        if (::fstat(fd, &status) == -1) {
+            int const error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "fstat");
+        }
+
+        size_ = static_cast<std::size_t>(status.st_size);
+        if (size_ != 0) {
+            void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            int const error = errno;
+            ::close(fd);
+            if (addr == MAP_FAILED)
+                throw std::system_error(error, std::generic_category(), "mmap");
+            ::madvise(addr, size_, MADV_SEQUENTIAL);
+            data_ = static_cast<char const *>(addr);
+        }
+        else
+            ::close(fd);
+    }
+
+    ~mapped_file()
+    {
+        if (data_)
+            ::munmap(const_cast<char *>(data_), size_);
+    }
+
+    mapped_file(mapped_file const &)            = delete;
+    mapped_file &operator=(mapped_file const &) = delete;
+    mapped_file(mapped_file &&)                 = delete;
+    mapped_file &operator=(mapped_file &&)      = delete;
+
+    std::string_view text() const noexcept
+    {
+        return std::string_view(data_, size_);
+    }
+
+  private:
+    char const  *data_ = nullptr;
+    std::size_t  size_ = 0;
+};
+
+namespace detail {
+
+// a run of whole lines of a file, tokenised by one of the worker threads
+struct file_part
+{
+    std::string_view                text;
+    std::vector<token>              tokens;
+    std::string_view                rest;       // a token that runs on past the end
+    std::optional<tokenise_error>   error;
+    bool                            done = false;
+};
+
+// splits the text after the first newline at or beyond every part_size
+// characters
+inline std::vector<file_part> split_lines(std::string_view text, std::size_t part_size)
+{
+    std::vector<file_part> parts;
+    for (std::size_t begin=0; begin<text.size(); ) {
+        auto end = text.size();
+        if (text.size() - begin > part_size) {
+            auto const newline = std::memchr(text.data() + begin + part_size, '\n', text.size() - begin - part_size);
+            if (newline)
+                end = static_cast<char const *>(newline) - text.data() + 1;
+        }
+        parts.emplace_back().text = text.substr(begin, end - begin);
+        begin = end;
+    }
+    return parts;
+}
+
+}   // namespace detail
+
+// Parallel file tokeniser
+//
+// Maps the file into memory, splits it at newlines into parts and
+// tokenises the parts concurrently on a number of threads with the rules
+// of the direct tokeniser, delivering the tokens to sink(tokeniser::token
+// const &) on the calling thread, in order and with the offsets they would
+// have had if the file had been tokenised as one expression. A line is a
+// token boundary unless a token, such as a string literal, runs on past
+// its end. When one runs on past the end of a part, the calling thread
+// tokenises on from its start until it reaches the end of a part between
+// tokens, looking twice as far ahead each time the token still hasn't
+// ended, and then goes back to the parts the threads have tokenised. An
+// error ends the expression, and so the file. The text of a token points
+// into the mapped file, so is only valid during the call to the sink.
+// Returns the error that ended the file early, if there is one
+//
+// A sink that takes (tokeniser::token const &, tokeniser::line_index
+// const &) is also given a line_index of the mapped file, to find the line
+// and column of a token. It is only valid during the call too, and the
+// newlines are only scanned for if the sink asks for a location
+//
+// Parts are a few megabytes, several to a thread, so that threads are
+// kept busy while the calling thread delivers the tokens of the part
+// before, and no more than two parts per thread are tokenised ahead of
+// the one being delivered, which bounds the memory used for their tokens.
+// Token vectors are reserved from the density of tokens in the parts
+// delivered so far
+template<typename StateMachine, typename Sink>
+    requires std::invocable<Sink &, token const &>  ||  std::invocable<Sink &, token const &, line_index const &>
+std::optional<tokenise_error> tokenise_file(direct_tokeniser<StateMachine> const &tokeniser, char const *path, Sink &&sink, unsigned threads = std::thread::hardware_concurrency())
+{
+    using stream_position = typename direct_tokeniser<StateMachine>::stream_position;
+
+    mapped_file const file(path);
+    auto const text = file.text();
+
+    line_index const lines(text);
+    auto deliver = [&sink, &lines](token const &tok) {
+        if constexpr (std::invocable<Sink &, token const &, line_index const &>)
+            sink(tok, lines);
+        else
+            sink(tok);
+    };
+
+    threads = std::max(threads, 1u);
+    auto const part_size = std::clamp<std::size_t>(text.size() / (threads * 8), 64 << 10, 4 << 20);
+    auto       parts     = detail::split_lines(text, part_size);
+    if (threads == 1  ||  parts.size() <= 1) {
+        stream_position position;
+        tokeniser.tokenise_part(text, deliver, position, true);
+        return position.error;
+    }
+
+    std::mutex              mutex;
+    std::condition_variable changed;
+    std::size_t             next      = 0;  // the next part to tokenise
+    std::size_t             delivered = 0;
+    std::size_t             tokens    = 0;  // in the parts delivered
+    std::size_t             bytes     = 0;
+    bool                    stop      = false;
+    auto const              ahead     = std::size_t(threads) * 2;
+
+    auto worker = [&] {
+        for (;;) {
+            std::size_t index;
+            std::size_t expected = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return stop  ||  next == parts.size()  ||  next < delivered + ahead; });
+                if (stop  ||  next == parts.size())
+                    return;
+                index = next++;
+                if (bytes != 0)
+                    expected = parts[index].text.size() * tokens / bytes;
+            }
+
+            auto &part = parts[index];
+            stream_position position;
+            position.offset = part.text.data() - text.data();
+            part.tokens.reserve(expected + expected / 8);
+            auto const rest = tokeniser.tokenise_part(part.text, [&part](token const &tok) { part.tokens.push_back(tok); }, position, index + 1 == parts.size());
+
+            std::lock_guard<std::mutex> lock(mutex);
+            part.rest  = rest;
+            part.error = position.error;
+            part.done  = true;
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> workers;
+    auto stop_workers = [&] {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        changed.notify_all();
+        for (auto &thread : workers)
+            thread.join();
+        workers.clear();
+    };
+
+    try {
+        for (unsigned i=0; i<threads; ++i)
+            workers.emplace_back(worker);
+
+        // the parts are delivered, or skipped, in order
+        auto finish_part = [&](detail::file_part &part, bool counted) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&part] { return part.done; });
+            }
+            auto const count = part.tokens.size();
+            std::vector<token>().swap(part.tokens);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ++delivered;
+                if (counted) {
+                    tokens += count;
+                    bytes  += part.text.size();
+                }
+            }
+            changed.notify_all();
+        };
+
+        for (std::size_t index=0; index<parts.size(); ) {
+            auto &part = parts[index];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&part] { return part.done; });
+            }
+
+            for (auto const &tok : part.tokens)
+                deliver(tok);
+            if (part.error) {
+                stop_workers();
+                return part.error;
+            }
+            auto rest = part.rest;
+            finish_part(part, rest.empty());
+            ++index;
+
+            // a token runs on into the parts after, whose threads started
+            // scanning in the middle of it. tokenise on from its start
+            // here, to the end of a window of parts that grows while the
+            // token doesn't end in it, and discard their results
+            for (std::size_t window=1; !rest.empty(); ) {
+                auto const end   = std::min(index + window, parts.size());
+                auto const start = rest.data() - text.data();
+                auto const until = parts[end - 1].text.data() + parts[end - 1].text.size() - text.data();
+
+                stream_position position;
+                position.offset = start;
+                rest = tokeniser.tokenise_part(text.substr(start, until - start), deliver, position, end == parts.size());
+                if (position.error) {
+                    stop_workers();
+                    return position.error;
+                }
+
+                for (; index<end; ++index)
+                    finish_part(parts[index], false);
+                if (!rest.empty()  &&  rest.data() == text.data() + start)
+                    window *= 2;
+                else
+                    window = 1;
+            }
+        }
+    }
+    catch (...) {
+        stop_workers();
+        throw;
+    }
+    stop_workers();
+    return std::nullopt;
+}
+
+}   // namespace tokeniser
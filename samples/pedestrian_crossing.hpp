@@ -1,276 +1,324 @@
-#pragma once
-
-#include "include/fsm.hpp"
-#include <iostream>
-
-namespace pedestrian_crossing {
-
-// Event are transitions between states
-namespace events {
-
-struct initialised
-{
-    // make the state object noncopyable
-    initialised()                               = default;
-    initialised(initialised &&)                 = default;
-    initialised &operator=(initialised &&)      = default;
-    initialised(initialised const &)            = delete;
-    initialised &operator=(initialised const &) = delete;
-};
-
-struct press_button
-{
-};
-
-template<typename Duration>
-struct timer
-{
-    timer(Duration duration) : duration(duration)
-    {
-    }
-
-    Duration duration;
-};
-template<typename Duration>
-timer<Duration> make_timer(Duration duration)
-{
-    return timer<Duration>(duration);
-}
-
-// this variant must include all events used in the state machine
-using type = std::variant<
-    initialised,
-    press_button,
-    timer<std::chrono::seconds>
->;
-
-}   // namespace events
-
-
-// Each state is implemented in a structure and can hold state
-// while it is active
-// Functions enter() and leave() are option, but if exist they
-// will be call by the finite state machine class during state
-// transitions
-namespace states {
-
-struct state_machine;
-using namespace std::literals::chrono_literals;
-
-struct state_base
-{
-    // make the state object noncopyable
-    state_base()                              = default;
-    state_base(state_base &&)                 = default;
-    state_base &operator=(state_base &&)      = default;
-    state_base(state_base const &)            = delete;
-    state_base &operator=(state_base const &) = delete;
-
-    template<typename StateMachine, typename Event>
-    void transition_after_time(StateMachine &fsm, Event &&event)
-    {
-        auto timer_fn = [this, &fsm, event]{
-            std::this_thread::sleep_for(event.duration);
-            fsm.set_event(event);
-        };
-        std::thread(timer_fn).detach();
-    }
-};
-
-struct initialising
-{
-};
-
-struct red : state_base
-{ 
-    std::chrono::seconds duration = 15s;
-
-    template<typename StateMachine>
-    void enter(StateMachine &fsm)
-    {
-        std::cout << "Lights are Red\n";
-        transition_after_time(fsm, events::make_timer(duration));
-    }
-};
-
-struct green
-{
-    template<typename StateMachine>
-    void enter(StateMachine &/*fsm*/)
-    {
-        std::cout << "Lights are Green\n";
-    }
-};
-
-struct green_button_pressed : state_base
-{
-    std::chrono::seconds duration;
-
-    green_button_pressed(std::chrono::seconds duration = 10s)
-        : duration(duration)
-    {
-    }
-
-    template<typename StateMachine>
-    void enter(StateMachine &fsm)
-    {
-        std::cout << "The lights are green and the button has been pressed. Please wait " << duration << '\n';
-        transition_after_time(fsm, events::make_timer(duration));
-    }
-};
-
-struct amber : state_base
-{
-    std::chrono::seconds duration = 2s;
-
-    template<typename StateMachine>
-    void enter(StateMachine &fsm)
-    {
-        std::cout << "Lights are Amber\n";
-        transition_after_time(fsm, events::make_timer(duration));
-    }
-};
-
-struct amber_flash : state_base
-{
-    std::chrono::seconds duration = 5s;
-
-    template<typename StateMachine>
-    void enter(StateMachine &fsm)
-    {
-        std::cout << "Lights are Flashing Amber\n";
-        transition_after_time(fsm, events::make_timer(duration));
-    }
-};
-
-struct amber_flash_button_pressed
-{
-    template<typename StateMachine>
-    void enter(StateMachine &fsm)
-    {
-        using namespace std::literals::chrono_literals;
-
-        std::cout << "Amber is flashing. Button press has been queued\n";
-        fsm.async_wait_for_state<states::green>(
-            [&fsm](){
-                fsm.set_event(events::press_button());
-            });
-    }
-};
-
-using type = std::variant<
-    initialising,   // initial state
-    red,
-    amber_flash,
-    amber_flash_button_pressed,
-    green,
-    green_button_pressed,
-    amber
->;
-
-}   // namespace states
-
-class crossing_state_machine
-    : public fsm::state_machine<crossing_state_machine, states::type, events::type>
-{
-  public:
-    using base_t = fsm::state_machine<crossing_state_machine, states::type, events::type>;
-
-    // enable default processing for undefined state/event pairs
-    using base_t::on_event;
-
-    // GREEN state events
-    states::type on_event(states::green &&state, events::press_button &&)
-    {
-        return states::green_button_pressed();
-    }
-
-    // GREEN, BUTTON PRESSED state events
-    template<typename Duration>
-    states::type on_event(states::green_button_pressed &&state, events::timer<Duration> &&)
-    {
-        return states::amber();
-    }
-
-    // AMBER state event
-    template<typename Duration>
-    states::type on_event(states::amber &&state, events::timer<Duration> &&)
-    {
-        return states::red();
-    }
-
-    // RED state events
-    template<typename Duration>
-    states::type on_event(states::red &&state, events::timer<Duration> &&)
-    {
-        return states::amber_flash();
-    }
-
-    states::type on_event(states::red &&state, events::press_button &&)
-    {
-        std::cout << "The lights are red, please cross the road now.\n";
-        return std::move(state);
-    }
-
-    // AMBER FLASHING state events
-    states::type on_event(states::amber_flash &&, events::press_button &&)
-    {
-        return states::amber_flash_button_pressed();
-    }
-
-    template<typename Duration>
-    states::type on_event(states::amber_flash &&state, events::timer<Duration> &&)
-    {
-        return states::green();
-    }
-
-    // AMBER FLASHING, BUTTON PRESSED state events
-    template<typename Duration>
-    states::type on_event(states::amber_flash_button_pressed &&state, events::timer<Duration> &&)
-    {
-        return states::green();
-    }
-
-    // all other states ignore the button press
-    states::type on_event(auto &&state, events::press_button &&)
-    {
-        std::cout << "Button has already been pressed. Please be patient.\n";
-        return std::move(state);
-    }
-
-    // INITIALISING state event
-    states::type on_event(states::initialising &&state, events::initialised &&)
-    {
-        // initialise to Green state
-        return states::green();
-    }
-};
-
-void run()
-{
-    crossing_state_machine crossing;
-    crossing.set_event(events::initialised());
-
-    bool quit = false;
-    while (!quit)
-    {
-        char ch;
-        std::cin.get(ch);
-
-        switch (ch)
-        {
-            
-            case 'q':
-            case 'Q':
-                quit = true;
-                break;
-
-            case 'b':
-            case 'B':
-                crossing.set_event(events::press_button());
-                break;
-        }
-    }
-}
-
-}   // namespace pedestrian_crossing
+#pragma once
+
+#include "include/fsm.hpp"
+#include <iostream>
+
+namespace pedestrian_crossing {
+
+// Event are transitions between states
+namespace events {
+
+struct initialised
+{
+    // make the state object noncopyable
+    initialised()                               = default;
+    initialised(initialised &&)                 = default;
+    initialised &operator=(initialised &&)      = default;
+    initialised(initialised const &)            = delete;
+    initialised &operator=(initialised const &) = delete;
+};
+
+struct press_button
+{
+};
+
+template<typename Duration>
+struct timer
+{
+    timer(Duration duration) : duration(duration)
+    {
+    }
+
+    Duration duration;
+};
+template<typename Duration>
+timer<Duration> make_timer(Duration duration)
+{
+    return timer<Duration>(duration);
+}
+
+// this variant must include all events used in the state machine
+using type = std::variant<
+    initialised,
+    press_button,
+    timer<std::chrono::seconds>
+>;
+
+}   // namespace events
+
+
+// Each state is implemented in a structure and can hold state
+// while it is active
+// Functions enter() and leave() are option, but if exist they
+// will be call by the finite state machine class during state
+// transitions
+namespace states {
+
+struct state_machine;
+using namespace std::literals::chrono_literals;
+
+struct state_base
+{
+    // make the state object noncopyable
+    state_base()                              = default;
+    state_base(state_base &&)                 = default;
+    state_base &operator=(state_base &&)      = default;
+    state_base(state_base const &)            = delete;
+    state_base &operator=(state_base const &) = delete;
+
+    template<typename StateMachine, typename Event>
+    void transition_after_time(StateMachine &fsm, Event &&event)
+    {
+        fsm.schedule_event(event.duration, std::forward<Event>(event));
+    }
+};
+
+struct initialising
+{
+};
+
+struct red : state_base
+{ 
+    std::chrono::seconds duration = 15s;
+
+    template<typename StateMachine>
+    void enter(StateMachine &fsm)
+    {
+        fsm.display() << "Lights are Red\n";
+        transition_after_time(fsm, events::make_timer(duration));
+    }
+};
+
+struct green
+{
+    template<typename StateMachine>
+    void enter(StateMachine &fsm)
+    {
+        fsm.display() << "Lights are Green\n";
+    }
+};
+
+struct green_button_pressed : state_base
+{
+    std::chrono::seconds duration;
+
+    green_button_pressed(std::chrono::seconds duration = 10s)
+        : duration(duration)
+    {
+    }
+
+    template<typename StateMachine>
+    void enter(StateMachine &fsm)
+    {
+        fsm.display() << "The lights are green and the button has been pressed. Please wait " << duration << '\n';
+        transition_after_time(fsm, events::make_timer(duration));
+    }
+};
+
+struct amber : state_base
+{
+    std::chrono::seconds duration = 2s;
+
+    template<typename StateMachine>
+    void enter(StateMachine &fsm)
+    {
+        fsm.display() << "Lights are Amber\n";
+        transition_after_time(fsm, events::make_timer(duration));
+    }
+};
+
+struct amber_flash : state_base
+{
+    std::chrono::seconds duration = 5s;
+
+    template<typename StateMachine>
+    void enter(StateMachine &fsm)
+    {
+        fsm.display() << "Lights are Flashing Amber\n";
+        transition_after_time(fsm, events::make_timer(duration));
+    }
+};
+
+struct amber_flash_button_pressed
+{
+    // hold button presses until the lights turn green
+    using deferred_events = fsm::defer<events::press_button>;
+
+    template<typename StateMachine>
+    void enter(StateMachine &fsm)
+    {
+        fsm.display() << "Amber is flashing. Button press has been queued\n";
+
+        // this press is deferred by the current state and re-injected by
+        // the state machine when the lights turn green
+        fsm.set_event(events::press_button());
+    }
+};
+
+using type = std::variant<
+    initialising,   // initial state
+    red,
+    amber_flash,
+    amber_flash_button_pressed,
+    green,
+    green_button_pressed,
+    amber
+>;
+
+}   // namespace states
+
+// The clock defaults to real time. Using fsm::virtual_clock simulates the
+// crossing without waiting for any of the timers
+template<typename Clock=fsm::steady_clock>
+class basic_crossing_state_machine
+    : public fsm::state_machine<basic_crossing_state_machine<Clock>, states::type, events::type, false, Clock>
+{
+  public:
+    using base_t = fsm::state_machine<basic_crossing_state_machine<Clock>, states::type, events::type, false, Clock>;
+
+    explicit basic_crossing_state_machine(std::ostream &display = std::cout)
+      : display_(display)
+    {
+    }
+
+    std::ostream &display()
+    {
+        return display_;
+    }
+
+    // enable default processing for undefined state/event pairs
+    using base_t::on_event;
+
+    // GREEN state events
+    auto react(states::green &, events::press_button &&)
+    {
+        return fsm::transition_to<states::green_button_pressed>();
+    }
+
+    // GREEN, BUTTON PRESSED state events
+    template<typename Duration>
+    states::type on_event(states::green_button_pressed &&, events::timer<Duration> &&)
+    {
+        return states::amber();
+    }
+
+    // AMBER state event
+    template<typename Duration>
+    states::type on_event(states::amber &&, events::timer<Duration> &&)
+    {
+        return states::red();
+    }
+
+    // RED state events
+    template<typename Duration>
+    states::type on_event(states::red &&, events::timer<Duration> &&)
+    {
+        return states::amber_flash();
+    }
+
+    fsm::stay react(states::red &, events::press_button &&)
+    {
+        display() << "The lights are red, please cross the road now.\n";
+        return {};
+    }
+
+    // AMBER FLASHING state events
+    auto react(states::amber_flash &, events::press_button &&)
+    {
+        return fsm::transition_to<states::amber_flash_button_pressed>();
+    }
+
+    template<typename Duration>
+    states::type on_event(states::amber_flash &&, events::timer<Duration> &&)
+    {
+        return states::green();
+    }
+
+    // AMBER FLASHING, BUTTON PRESSED state events
+    template<typename Duration>
+    states::type on_event(states::amber_flash_button_pressed &&, events::timer<Duration> &&)
+    {
+        return states::green();
+    }
+
+    // all other states ignore the button press
+    fsm::stay react(auto &, events::press_button &&)
+    {
+        display() << "Button has already been pressed. Please be patient.\n";
+        return {};
+    }
+
+    // INITIALISING state event
+    states::type on_event(states::initialising &&, events::initialised &&)
+    {
+        // initialise to Green state
+        return states::green();
+    }
+
+  private:
+    std::ostream &display_;
+};
+
+using crossing_state_machine = basic_crossing_state_machine<>;
+
+void run()
+{
+    crossing_state_machine crossing;
+    crossing.set_event(events::initialised());
+
+    bool quit = false;
+    while (!quit)
+    {
+        char ch;
+        std::cin.get(ch);
+
+        switch (ch)
+        {
+            
+            case 'q':
+            case 'Q':
+                quit = true;
+                break;
+
+            case 'b':
+            case 'B':
+                crossing.set_event(events::press_button());
+                break;
+        }
+    }
+}
+
+// Run the crossing on simulated time, with a pedestrian arriving a minute
+// after each time the lights turn red, and report the simulation speed
+void simulate(std::size_t cycles = 1'000'000)
+{
+    using namespace std::literals::chrono_literals;
+    using crossing_t = basic_crossing_state_machine<fsm::virtual_clock>;
+
+    std::ostream  no_display(nullptr);
+    crossing_t    crossing(no_display);
+    std::uint64_t events_delivered = 0;
+    std::size_t   pedestrians      = 0;
+
+    // the observer runs on the event thread, so scheduling from it keeps
+    // the simulation deterministic
+    crossing.add_dispatch_observer(
+        [&](events::type const &, std::size_t) {
+            ++events_delivered;
+            if (crossing.is_in<states::amber>()  &&  ++pedestrians < cycles)
+                crossing.schedule_event(60s, events::press_button());
+        });
+
+    auto const start = std::chrono::steady_clock::now();
+    crossing.set_event(events::initialised());
+    crossing.schedule_event(30s, events::press_button());
+    crossing.wait_for_idle();
+    auto const elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start);
+
+    std::cout << "Simulated " << cycles << " crossing cycles, "
+              << std::chrono::duration_cast<std::chrono::hours>(crossing.clock().now().time_since_epoch()).count()
+              << " hours of traffic, in " << elapsed.count() << "s ("
+              << events_delivered / elapsed.count() << " events/s)\n";
+}
+
+}   // namespace pedestrian_crossing
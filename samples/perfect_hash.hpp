@@ -0,0 +1,112 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+namespace tokeniser {
+
+// A fixed set of strings, such as the keywords or operators of a
+// language, mapped to values by a perfect hash that is found at compile
+// time, so the table is a constant shared by every tokeniser using it. A
+// lookup hashes the key once and compares it with the one entry it can
+// match
+//
+//     static constexpr auto keywords = tokeniser::make_perfect_hash_map<keyword_type>({
+//         { "if",    keyword_type::kw_if },
+//         { "while", keyword_type::kw_while },
+//     });
+template<typename Value, std::size_t Size>
+class perfect_hash_map
+{
+    static_assert(Size < 256, "entries are indexed by a byte");
+
+  public:
+    using entry = std::pair<std::string_view, Value>;
+
+    consteval explicit perfect_hash_map(std::array<entry, Size> const &entries)
+      : entries_(entries)
+    {
+        for (auto const &entry : entries_)
+            max_length_ = std::max(max_length_, entry.first.size());
+
+        // with sixteen slots to an entry, a few seeds are tried on average
+        // before one hashes every entry to a slot of its own. running out
+        // of seeds, which it will if there are duplicate entries, is a
+        // compile error
+        for (seed_=0; !place_entries(); ++seed_) {
+            if (seed_ == 1 << 16)
+                throw "no perfect hash for the entries";
+        }
+    }
+
+    constexpr Value const *find(std::string_view key) const noexcept
+    {
+        if (key.size() > max_length_)
+            return nullptr;
+
+        auto const index = slots_[slot(key, seed_)];
+        if (index == 0  ||  entries_[index - 1].first != key)
+            return nullptr;
+        return &entries_[index - 1].second;
+    }
+
+    constexpr bool contains(std::string_view key) const noexcept
+    {
+        return find(key) != nullptr;
+    }
+
+    constexpr auto begin() const noexcept
+    {
+        return entries_.begin();
+    }
+
+    constexpr auto end() const noexcept
+    {
+        return entries_.end();
+    }
+
+  private:
+    static constexpr std::size_t slot_count = std::bit_ceil(Size) * 16;
+
+    // FNV-1a from the seed
+    static constexpr std::size_t slot(std::string_view key, std::uint32_t seed) noexcept
+    {
+        auto hash = seed ^ 0x811c9dc5u;
+        for (auto ch : key)
+            hash = (hash ^ static_cast<unsigned char>(ch)) * 0x01000193u;
+        return (hash ^ (hash >> 16)) & (slot_count - 1);
+    }
+
+    constexpr bool place_entries() noexcept
+    {
+        slots_ = {};
+        for (std::size_t index=0; index<Size; ++index) {
+            auto &slot_index = slots_[slot(entries_[index].first, seed_)];
+            if (slot_index != 0)
+                return false;
+            slot_index = static_cast<std::uint8_t>(index + 1);
+        }
+        return true;
+    }
+
+  private:
+    std::array<entry, Size>                   entries_;
+    std::array<std::uint8_t, slot_count>      slots_{};   // the index of the entry in each slot, from 1
+    std::size_t                               max_length_ = 0;
+    std::uint32_t                             seed_       = 0;
+};
+
+template<typename Value, std::size_t Size>
+consteval auto make_perfect_hash_map(std::pair<std::string_view, Value> const (&entries)[Size])
+{
+    std::array<std::pair<std::string_view, Value>, Size> array{};
+    for (std::size_t index=0; index<Size; ++index)
+        array[index] = entries[index];
+    return perfect_hash_map<Value, Size>(array);
+}
+
+}   // namespace tokeniser